@@ -4,11 +4,18 @@
  *---------------------------------------------------------------------------*/
 #include "pspmd.h"
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/fb.h>
+#include <linux/kd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/poll.h>
+#include <sched.h>
 
 
 //-----------------------------------------------------------------------------
@@ -24,14 +31,36 @@ typedef struct
 //-----------------------------------------------------------------------------
 // Constants
 //-----------------------------------------------------------------------------
+// The flat binary gets a fixed stack of this size, the Makefile passes the
+// same value to elf2flt
+#ifndef PSPMD_STACK_SIZE
+#define PSPMD_STACK_SIZE  ( 64 * 1024 )
+#endif
+
 static const char c_vcsDevName[]          = "/dev/vcs";
+static const char c_vcsaDevName[]         = "/dev/vcsa";
+static const char c_vcsuDevName[]         = "/dev/vcsu";
 static const char c_fbDevName[]           = "/dev/fb";
 static const char c_mouseDevName[]        = "/dev/mouse";
+static const char c_ttyDevName[]          = "/dev/tty0";
+static const char c_statsFileName[]       = "/tmp/pspmd.stats";
+static const char c_recFileName[]         = "/tmp/pspmd.rec";
+static const char c_ringFileName[]        = "/tmp/pspmd.ring";
+static const char c_controlFileName[]     = "/tmp/pspmd.ctl";
+static const char c_stateFileName[]       = "/tmp/pspmd.state";
+static const char c_handoffFileName[]     = "/tmp/pspmd.handoff";
 static const int  c_mouseInfoSize         = 3;
+static const unsigned int c_fontMaxWidth  = 32;   // Largest console font
+static const unsigned int c_fontMaxHeight = 32;
+static const unsigned int c_fontMaxCount  = 512;
 
 static const int INVALID_FD               = -1;
 static const int PSP_VCS_IOCTL_PUTCHAR    = 101;
 static const int PSP_VCS_IOCTL_GET_SIZE   = 109;
+static const char TIOCL_SET_SELECTION     = 2;
+static const char TIOCL_GET_MOUSE_REPORTING = 7;
+static const char TIOCL_SCROLL_CONSOLE    = 13;
+static const unsigned short TIOCL_SEL_MOUSE_REPORT = 16;
 
 static const unsigned int c_mouseBtnMask  = 0x7;
 static const unsigned int c_mouseBtnLeft  = 0x1;
@@ -44,7 +73,81 @@ static const unsigned int c_drawColor     = 0x00aaaaaa;
 static const unsigned int c_cursorColor    = ( c_cursorMask | c_drawColor );
 static const unsigned int c_highlightColor = ( c_highlightMask | c_drawColor );
 
+static const unsigned int c_tintRgb       = 0x003070ff;
+static const int          c_benchAlpha    = 128;
+static const char         c_benchPattern[] = "the ";
+static const int          c_benchPackets  = 4096;
+static const int          c_benchSlowDelta = 1;
+static const int          c_benchFastDelta = 127;
+
 static const unsigned int c_failureDelay  = 1;  // 1 second
+static const unsigned int c_geometryMsec  = 250;  // Longest a mode switch
+                                                // goes unnoticed without
+                                                // a console notification
+static const unsigned int c_reportingMsec = 250;  // Longest a switch to
+                                                // mouse reporting goes
+                                                // unnoticed
+
+static const int c_defaultRtPriority      = 10;
+static const int c_arenaCellBytes         = 17; // Snapshots, search, code
+                                                // points, marks and a copy
+static const int c_arenaLineBytes         = 48; // Row and column tables
+static const int c_arenaFixedBytes        = 64 * 1024;  // Pointer sprite,
+                                                // stitched lines, headers
+static const int c_arenaHeadroom          = 50; // Percent for a mode switch
+static const int c_stackPrefaultSize      = PSPMD_STACK_SIZE / 2;  // The
+                                                // daemon itself lives in
+                                                // main()'s frame above it
+static const int c_pageSize               = 4096;
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+static unsigned int channel(unsigned int value_, int offset_, int length_)
+{
+  return ( ( value_ & 0xff ) >> ( 8 - length_ ) ) << offset_;
+}
+//-----------------------------------------------------------------------------
+static unsigned int elapsedUsec(const struct timeval & from_)
+{
+  struct timeval now;
+  (void)gettimeofday( &now, NULL );
+
+  return (unsigned int)( ( now.tv_sec - from_.tv_sec ) * 1000000 +
+                         ( now.tv_usec - from_.tv_usec ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Struct: PspMdOptions
+//-----------------------------------------------------------------------------
+PspMdOptions::PspMdOptions()
+  : lowLatency( false ),
+    rtPriority( c_defaultRtPriority ),
+    doubleBuffer( false ),
+    pointer( false ),
+    alpha( 0 ),
+    benchPasses( 0 ),
+    matches( false ),
+    service( false ),
+    control( false ),
+    mouseCount( 0 ),
+    accelSpeed( 100 ),
+    accelFactor( 100 ),
+    accelThreshold( 0 ),
+    renderer( RENDERER_AUTO ),
+    idleSec( 0 ),
+    arenaKb( -1 ),
+    footprint( false ),
+    persist( false ),
+    handoff( false ),
+    fontWidth( 0 ),
+    fontHeight( 0 )
+{
+  for ( int i = 0; i < MAX_MICE; i++ )
+    mice[ i ] = NULL;
+}
 
 
 //-----------------------------------------------------------------------------
@@ -53,8 +156,13 @@ static const unsigned int c_failureDelay  = 1;  // 1 second
 PspMdConsole::PspMdConsole(PspMouseDaemon & md_)
   : m_md( md_ ),
     m_vcsFd( INVALID_FD ),
+    m_vcsuFd( INVALID_FD ),
+    m_ttyFd( INVALID_FD ),
     m_cols( 0 ),
-    m_rows( 0 )
+    m_rows( 0 ),
+    m_reporting( false ),
+    m_reportingKnown( false ),
+    m_reportingMsec( 0 )
 {
 }
 //-----------------------------------------------------------------------------
@@ -65,9 +173,21 @@ PspMdConsole::~PspMdConsole()
     (void)close( m_vcsFd );
     m_vcsFd = INVALID_FD;
   }
+
+  if ( m_vcsuFd >= 0 )
+  {
+    (void)close( m_vcsuFd );
+    m_vcsuFd = INVALID_FD;
+  }
+
+  if ( m_ttyFd >= 0 )
+  {
+    (void)close( m_ttyFd );
+    m_ttyFd = INVALID_FD;
+  }
 }
 //-----------------------------------------------------------------------------
-bool PspMdConsole::Initialize()
+bool PspMdConsole::Initialize(int vcsFd_, int vcsuFd_)
 {
   if ( m_vcsFd >= 0 )
   {
@@ -75,24 +195,87 @@ bool PspMdConsole::Initialize()
     return true;
   }
 
-  m_vcsFd = open( c_vcsDevName, O_RDONLY );
+  // Descriptors handed over by a previous instance are taken as they are
+  m_vcsFd = ( vcsFd_ >= 0 ) ? vcsFd_ : open( c_vcsDevName, O_RDONLY );
   if ( m_vcsFd < 0 )
   {
+    m_md.GetRecorder().Record( EVT_OPEN_FAIL, DEV_VCS, errno );
     DBG(( DBG_PREFIX "Failed to open vcs driver, err=%d\n", m_vcsFd ));
     return false;
   }
 
+  // Older kernels have no vcsu, copies then take the bytes of the font
+  m_vcsuFd = ( vcsuFd_ >= 0 ) ? vcsuFd_ : open( c_vcsuDevName, O_RDONLY );
+
+  return readSize( m_cols, m_rows );
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::Refresh(int & cols_, int & rows_, bool & resized_)
+{
+  // The new size is only reported. The daemon commits it with Resize()
+  // once the overlay is off the cells of the old one.
+  cols_ = m_cols;
+  rows_ = m_rows;
+  resized_ = false;
+
+  if ( !readSize( cols_, rows_ ) )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    cols_ = m_cols;
+    rows_ = m_rows;
+    return false;
+  }
+
+  resized_ = ( cols_ != m_cols || rows_ != m_rows );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::readSize(int & cols_, int & rows_)
+{
   psp_vcs_size_t sz;
   int rt = ioctl( m_vcsFd, PSP_VCS_IOCTL_GET_SIZE, (int)&sz );
   if ( rt < 0 )
   {
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_VCS, errno,
+                               PSP_VCS_IOCTL_GET_SIZE );
     DBG(( DBG_PREFIX "Failed to obtain vcs size, err=%d\n", rt ));
     return false;
   }
 
-  m_cols = (int)sz.cols;
-  m_rows = (int)sz.rows;
+  cols_ = (int)sz.cols;
+  rows_ = (int)sz.rows;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::GetFontSize(int & width_, int & height_)
+{
+  width_ = 0;
+  height_ = 0;
+
+  // The vcs driver knows nothing about fonts, ask the console tty
+  int ttyFd = open( c_ttyDevName, O_RDONLY );
+  if ( ttyFd < 0 )
+    return false;
+
+  // No data buffer, only the font metrics are wanted. The limits must
+  // hold any font or the kernel fails with ENOSPC, it reports the real
+  // size in their place.
+  struct console_font_op op;
+  op.op = KD_FONT_OP_GET;
+  op.flags = 0;
+  op.width = c_fontMaxWidth;
+  op.height = c_fontMaxHeight;
+  op.charcount = c_fontMaxCount;
+  op.data = NULL;
+
+  int rt = ioctl( ttyFd, KDFONTOP, &op );
+  (void)close( ttyFd );
+
+  if ( rt < 0 || op.width == 0 || op.height == 0 )
+    return false;
 
+  width_ = (int)op.width;
+  height_ = (int)op.height;
   return true;
 }
 //-----------------------------------------------------------------------------
@@ -113,6 +296,8 @@ bool PspMdConsole::Seek(unsigned int pos_)
   int rt = lseek( m_vcsFd, pos_, SEEK_SET );
   if ( rt < 0 || rt != pos_ )
   {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_SEEK_FAIL, DEV_VCS, errno, pos_ );
     DBG(( DBG_PREFIX "Failed to seek vcs, err=%d\n", rt ));
     return false;
   }
@@ -143,6 +328,8 @@ bool PspMdConsole::Read
   int rt = read( m_vcsFd, buf_, size_ );
   if ( rt < 0 )
   {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_READ_FAIL, DEV_VCS, errno, size_ );
     DBG(( DBG_PREFIX "Failed to read vcs device, err=%d\n", rt ));
     return false;
   }
@@ -151,16 +338,153 @@ bool PspMdConsole::Read
   return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMdConsole::Paste(const char * str_)
+bool PspMdConsole::ReadCodes
+(
+  unsigned int pos_,
+  unsigned int * codes_,
+  unsigned int count_,
+  unsigned int & codesRead_
+)
+{
+  codesRead_ = 0;
+
+  if ( m_vcsuFd < 0 )
+  {
+    DBG(( DBG_PREFIX "Tried to read an invalid vcsu device\n" ));
+    return false;
+  }
+
+  // vcsu holds one 32-bit code point per cell
+  int rt = pread( m_vcsuFd, codes_, count_ * sizeof( unsigned int ),
+                  pos_ * sizeof( unsigned int ) );
+  if ( rt < 0 )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_READ_FAIL, DEV_VCS, errno, count_ );
+    DBG(( DBG_PREFIX "Failed to read vcsu device, err=%d\n", rt ));
+    return false;
+  }
+
+  codesRead_ = (unsigned int)rt / sizeof( unsigned int );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::Paste(const char * text_, int size_)
 {
-  for ( ; *str_ != 0; str_++ )
+  for ( int i = 0; i < size_; i++ )
   {
-    int rt = ioctl( m_vcsFd, PSP_VCS_IOCTL_PUTCHAR, (int)( *str_ ) );
+    int rt = ioctl( m_vcsFd, PSP_VCS_IOCTL_PUTCHAR, (int)( text_[ i ] ) );
     if ( rt < 0 )
     {
+      m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+      m_md.GetRecorder().Record( EVT_WRITE_FAIL, DEV_VCS, errno, i );
       DBG(( DBG_PREFIX "Failed to paste to console, err=%d\n", rt ));
       return false;
     }
+
+    m_md.GetStats().Add( PspMdStats::PASTE_BYTES );
+  }
+
+  m_md.GetRecorder().Record( EVT_PASTE, size_ );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::Scroll(int lines_)
+{
+  if ( !openTty() )
+    return false;
+
+  // The subcode sits in the first byte, the line count in the next word.
+  // Positive counts scroll towards the newest output.
+  int arg[ 2 ];
+  arg[ 0 ] = 0;
+  *(char *)arg = TIOCL_SCROLL_CONSOLE;
+  arg[ 1 ] = lines_;
+
+  if ( ioctl( m_ttyFd, TIOCLINUX, arg ) < 0 )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_VCS, errno, lines_ );
+    DBG(( DBG_PREFIX "Failed to scroll the console, err=%d\n", errno ));
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::GetMouseReporting(bool & enabled_)
+{
+  // Every batch asks, the answer is kept for c_reportingMsec so a burst of
+  // motion costs one ioctl
+  const unsigned int now = m_md.GetRecorder().GetMsec();
+  if ( m_reportingKnown && now - m_reportingMsec < c_reportingMsec )
+  {
+    enabled_ = m_reporting;
+    return true;
+  }
+
+  enabled_ = false;
+  if ( !openTty() )
+    return false;
+
+  // The mode the application asked for is the return value of the ioctl
+  char arg = TIOCL_GET_MOUSE_REPORTING;
+  const int rt = ioctl( m_ttyFd, TIOCLINUX, &arg );
+  if ( rt < 0 )
+  {
+    m_reportingKnown = false;
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_VCS, errno );
+    return false;
+  }
+
+  m_reporting = ( rt > 0 );
+  m_reportingKnown = true;
+  m_reportingMsec = now;
+  enabled_ = m_reporting;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::ReportMouse(int button_, int col_, int row_)
+{
+  if ( !openTty() )
+    return false;
+
+  // A selection request in report mode makes the console queue the
+  // xterm sequence ESC [ M b x y as input. The request follows the
+  // subcode unaligned: both corners at the 1-based cell, then the mode
+  // carrying the button.
+  unsigned short selection[ 5 ];
+  selection[ 0 ] = (unsigned short)( col_ + 1 );
+  selection[ 1 ] = (unsigned short)( row_ + 1 );
+  selection[ 2 ] = selection[ 0 ];
+  selection[ 3 ] = selection[ 1 ];
+  selection[ 4 ] = (unsigned short)( TIOCL_SEL_MOUSE_REPORT + button_ );
+
+  char arg[ 1 + sizeof( selection ) ];
+  arg[ 0 ] = TIOCL_SET_SELECTION;
+  memcpy( arg + 1, selection, sizeof( selection ) );
+
+  if ( ioctl( m_ttyFd, TIOCLINUX, arg ) < 0 )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_VCS, errno, button_ );
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdConsole::openTty()
+{
+  if ( m_ttyFd >= 0 )
+    return true;
+
+  m_ttyFd = open( c_ttyDevName, O_RDONLY );
+  if ( m_ttyFd < 0 )
+  {
+    m_md.GetRecorder().Record( EVT_OPEN_FAIL, DEV_VCS, errno );
+    return false;
   }
 
   return true;
@@ -173,12 +497,30 @@ bool PspMdConsole::Paste(const char * str_)
 PspMdScreen::PspMdScreen(PspMouseDaemon & md_)
   : m_md( md_ ),
     m_fbFd( INVALID_FD ),
+    m_mapBase( NULL ),
     m_vramBase( NULL ),
     m_vramSize( 0 ),
     m_width( 0 ),
     m_height( 0 ),
     m_virtualWidth( 0 ),
-    m_virtualHeight( 0 )
+    m_virtualHeight( 0 ),
+    m_lineLength( 0 ),
+    m_bytesPerPixel( 0 ),
+    m_xOffset( 0 ),
+    m_yOffset( 0 ),
+    m_redOffset( 16 ),
+    m_redLength( 8 ),
+    m_greenOffset( 8 ),
+    m_greenLength( 8 ),
+    m_blueOffset( 0 ),
+    m_blueLength( 8 ),
+    m_prefault( false ),
+    m_doubleBuffer( false ),
+    m_vsync( true ),
+    m_backBase( NULL ),
+    m_backYOffset( -1 ),
+    m_damageTop( 0 ),
+    m_damageBottom( 0 )
 {
 }
 //-----------------------------------------------------------------------------
@@ -186,19 +528,14 @@ PspMdScreen::~PspMdScreen()
 {
   if ( m_fbFd >= 0 )
   {
-    if ( m_vramBase != NULL && m_vramSize != 0 )
-    {
-      (void)munmap( m_vramBase, m_vramSize );
-      m_vramBase = NULL;
-      m_vramSize = 0;
-    }
+    unmap();
 
     (void)close( m_fbFd );
     m_fbFd = INVALID_FD;
   }
 }
 //-----------------------------------------------------------------------------
-bool PspMdScreen::Initialize()
+bool PspMdScreen::Initialize(int fbFd_, bool prefault_, bool doubleBuffer_)
 {
   if ( m_fbFd >= 0 )
   {
@@ -206,46 +543,303 @@ bool PspMdScreen::Initialize()
     return true;
   }
 
-  m_fbFd = open( c_fbDevName, O_RDWR );
+  // A handed over descriptor is still mapped by the previous instance,
+  // the mapping is made again for this one
+  m_fbFd = ( fbFd_ >= 0 ) ? fbFd_ : open( c_fbDevName, O_RDWR );
   if ( m_fbFd < 0 )
   {
+    m_md.GetRecorder().Record( EVT_OPEN_FAIL, DEV_FB, errno );
     DBG(( DBG_PREFIX "Failed to open framebuffer driver, err=%d\n", m_fbFd ));
     return false;
   }
 
+  struct fb_var_screeninfo vinfo;
+  if ( !readMode( vinfo ) )
+    return false;
+
+  m_prefault = prefault_;
+  m_doubleBuffer = doubleBuffer_;
+  return map( vinfo.xoffset, vinfo.yoffset );
+}
+//-----------------------------------------------------------------------------
+bool PspMdScreen::Refresh(bool & remapped_, bool & resized_)
+{
+  remapped_ = false;
+  resized_ = false;
+
   struct fb_var_screeninfo vinfo;
   int rt = ioctl( m_fbFd, FBIOGET_VSCREENINFO, &vinfo );
   if ( rt < 0 )
   {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_FB, errno,
+                               FBIOGET_VSCREENINFO );
+    return false;
+  }
+
+  if ( (int)vinfo.xres != m_width ||
+       (int)vinfo.yres != m_height ||
+       (int)vinfo.xres_virtual != m_virtualWidth ||
+       (int)vinfo.yres_virtual != m_virtualHeight ||
+       (int)( vinfo.bits_per_pixel >> 3 ) != m_bytesPerPixel )
+  {
+    // The mode has been switched, the scanline length may change too
+    unmap();
+    remapped_ = true;
+    resized_ = true;
+
+    if ( !readMode( vinfo ) )
+      return false;
+
+    return map( vinfo.xoffset, vinfo.yoffset );
+  }
+
+  if ( (int)vinfo.xoffset == m_xOffset && (int)vinfo.yoffset == m_yOffset )
+    return true;
+
+  // A flip may still be pending in the driver
+  if ( m_backBase != NULL &&
+       (int)vinfo.xoffset == m_xOffset && (int)vinfo.yoffset == m_backYOffset )
+  {
+    return true;
+  }
+
+  // The console has been panned, follow the visible window
+  unmap();
+  remapped_ = true;
+  return map( vinfo.xoffset, vinfo.yoffset );
+}
+//-----------------------------------------------------------------------------
+bool PspMdScreen::readMode(struct fb_var_screeninfo & vinfo_)
+{
+  struct fb_fix_screeninfo finfo;
+  int rt = ioctl( m_fbFd, FBIOGET_FSCREENINFO, &finfo );
+  if ( rt < 0 )
+  {
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_FB, errno,
+                               FBIOGET_FSCREENINFO );
+    DBG(( DBG_PREFIX "Failed to obtain framebuffer fix info, err=%d\n", rt ));
+    return false;
+  }
+
+  rt = ioctl( m_fbFd, FBIOGET_VSCREENINFO, &vinfo_ );
+  if ( rt < 0 )
+  {
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_FB, errno,
+                               FBIOGET_VSCREENINFO );
     DBG(( DBG_PREFIX "Failed to obtain framebuffer info, err=%d\n", rt ));
     return false;
   }
 
-  m_vramSize = vinfo.xres_virtual *
-               vinfo.yres_virtual *
-               ( vinfo.bits_per_pixel >> 3 );
-  m_width = vinfo.xres;
-  m_height = vinfo.yres;
-  m_virtualWidth = vinfo.xres_virtual;
-  m_virtualHeight = vinfo.yres_virtual;
+  m_width = vinfo_.xres;
+  m_height = vinfo_.yres;
+  m_virtualWidth = vinfo_.xres_virtual;
+  m_virtualHeight = vinfo_.yres_virtual;
+  m_bytesPerPixel = vinfo_.bits_per_pixel >> 3;
+  m_lineLength = finfo.line_length;
+  if ( m_lineLength == 0 )
+    m_lineLength = m_virtualWidth * m_bytesPerPixel;
+
+  if ( vinfo_.red.length > 0 && vinfo_.red.length <= 8 &&
+       vinfo_.green.length > 0 && vinfo_.green.length <= 8 &&
+       vinfo_.blue.length > 0 && vinfo_.blue.length <= 8 )
+  {
+    m_redOffset   = vinfo_.red.offset;
+    m_redLength   = vinfo_.red.length;
+    m_greenOffset = vinfo_.green.offset;
+    m_greenLength = vinfo_.green.length;
+    m_blueOffset  = vinfo_.blue.offset;
+    m_blueLength  = vinfo_.blue.length;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+unsigned int PspMdScreen::MakePixel(unsigned int rgb_) const
+{
+  return channel( rgb_ >> 16, m_redOffset, m_redLength ) |
+         channel( rgb_ >> 8, m_greenOffset, m_greenLength ) |
+         channel( rgb_, m_blueOffset, m_blueLength );
+}
+//-----------------------------------------------------------------------------
+bool PspMdScreen::map(int xOffset_, int yOffset_)
+{
+  // When double buffering, the back page is the one next to the visible
+  // window inside the virtual framebuffer
+  int backYOffset = -1;
+  if ( m_doubleBuffer )
+  {
+    if ( yOffset_ + 2 * m_height <= m_virtualHeight )
+      backYOffset = yOffset_ + m_height;
+    else if ( yOffset_ >= m_height )
+      backYOffset = yOffset_ - m_height;
+    else
+      m_md.GetRecorder().Record( EVT_NO_BACK_PAGE, yOffset_, m_virtualHeight );
+  }
+
+  const int top = ( backYOffset >= 0 && backYOffset < yOffset_ ) ?
+                  backYOffset : yOffset_;
+  const int rows = ( backYOffset >= 0 ) ? 2 * m_height : m_height;
+
+  // Only the visible window (and the back page) is mapped. mmap() wants a
+  // page aligned offset, so the mapping starts at the page holding the
+  // first pixel.
+  const unsigned int first = top * m_lineLength +
+                             xOffset_ * m_bytesPerPixel;
+  const unsigned int offset = first & ~( c_pageSize - 1 );
+  const unsigned int lead = first - offset;
+  const unsigned int size = lead +
+                            ( rows - 1 ) * m_lineLength +
+                            m_width * m_bytesPerPixel;
+
+  m_vramSize = ( size + c_pageSize - 1 ) & ~( c_pageSize - 1 );
+
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if ( m_prefault )
+    flags |= MAP_POPULATE;
+#endif
+
+  m_mapBase = mmap( NULL,
+                    m_vramSize,
+                    PROT_READ | PROT_WRITE,
+                    flags,
+                    m_fbFd,
+                    offset );
+  if ( m_mapBase == MAP_FAILED )
+  {
+    m_md.GetRecorder().Record( EVT_MMAP_FAIL, DEV_FB, errno, m_vramSize );
+    DBG(( DBG_PREFIX "Failed to map framebuffer memory, size=%u\n",
+          m_vramSize ));
+    m_mapBase = NULL;
+    m_vramSize = 0;
+    return false;
+  }
+
+  char * topBase = (char *)m_mapBase + lead;
+  m_vramBase = (unsigned int *)( topBase + ( yOffset_ - top ) * m_lineLength );
+  m_xOffset = xOffset_;
+  m_yOffset = yOffset_;
+
+  if ( m_prefault )
+  {
+    // Touch every page now rather than on the first draw
+    volatile char * p = (volatile char *)m_mapBase;
+    for ( unsigned int i = 0; i < m_vramSize; i += c_pageSize )
+      (void)p[ i ];
+  }
+
+  m_backBase = NULL;
+  m_backYOffset = backYOffset;
+  m_damageTop = m_height;
+  m_damageBottom = 0;
+
+  if ( backYOffset >= 0 )
+  {
+    // Both pages start out identical, from then on only damage is copied
+    m_backBase = (unsigned int *)( topBase +
+                                   ( backYOffset - top ) * m_lineLength );
+    copyRows( m_backBase, m_vramBase, 0, m_height );
+  }
 
-  m_vramBase = (unsigned int *)mmap( NULL,
-                                     m_vramSize,
-                                     PROT_READ | PROT_WRITE,
-                                     MAP_SHARED,
-                                     m_fbFd,
-                                     0 );
-  if ( (unsigned int)m_vramBase == (unsigned int)( -1 ) )
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdScreen::unmap()
+{
+  if ( m_mapBase != NULL && m_vramSize != 0 )
   {
-    DBG(( DBG_PREFIX "Failed to map framebuffer memory, err=%d\n", m_vramBase ));
+    (void)munmap( m_mapBase, m_vramSize );
+    m_mapBase = NULL;
     m_vramBase = NULL;
+    m_backBase = NULL;
     m_vramSize = 0;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdScreen::present()
+{
+  if ( m_damageTop >= m_damageBottom )
+    return true;
+
+  struct fb_var_screeninfo vinfo;
+  int rt = ioctl( m_fbFd, FBIOGET_VSCREENINFO, &vinfo );
+  if ( rt == 0 )
+  {
+    vinfo.xoffset = m_xOffset;
+    vinfo.yoffset = m_backYOffset;
+    rt = ioctl( m_fbFd, FBIOPAN_DISPLAY, &vinfo );
+  }
+
+  if ( rt < 0 )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_IOCTL_FAIL, DEV_FB, errno,
+                               FBIOPAN_DISPLAY );
     return false;
   }
 
+  // The old front page may only be touched once it is off the screen
+#ifdef FBIO_WAITFORVSYNC
+  if ( m_vsync )
+  {
+    unsigned int crtc = 0;
+    if ( ioctl( m_fbFd, FBIO_WAITFORVSYNC, &crtc ) < 0 )
+      m_vsync = false;
+  }
+#endif
+
+  unsigned int * base = m_vramBase;
+  m_vramBase = m_backBase;
+  m_backBase = base;
+
+  int yOffset = m_yOffset;
+  m_yOffset = m_backYOffset;
+  m_backYOffset = yOffset;
+
+  // Bring the new back page up to date, only where the pages differ
+  copyRows( m_backBase, m_vramBase, m_damageTop, m_damageBottom );
+
+  PspMdStats & stats = m_md.GetStats();
+  stats.Add( PspMdStats::PAGE_FLIPS );
+  stats.Add( PspMdStats::ROWS_COPIED, m_damageBottom - m_damageTop );
+
+  m_damageTop = m_height;
+  m_damageBottom = 0;
   return true;
 }
 //-----------------------------------------------------------------------------
+void PspMdScreen::CopyFront(int y_, int height_)
+{
+  // Rows the console has drawn on the page shown, before the back page is
+  // drawn on
+  if ( m_backBase == NULL )
+    return;
+
+  copyRows( m_backBase, m_vramBase, y_, y_ + height_ );
+  m_md.GetStats().Add( PspMdStats::ROWS_COPIED, height_ );
+}
+//-----------------------------------------------------------------------------
+void PspMdScreen::copyRows
+(
+  unsigned int * to_,
+  const unsigned int * from_,
+  int top_,
+  int bottom_
+)
+{
+  const int bytes = m_width * m_bytesPerPixel;
+  char * to = (char *)to_ + top_ * m_lineLength;
+  const char * from = (const char *)from_ + top_ * m_lineLength;
+
+  for ( int i = top_; i < bottom_; i++ )
+  {
+    memcpy( to, from, bytes );
+    to += m_lineLength;
+    from += m_lineLength;
+  }
+}
+//-----------------------------------------------------------------------------
 bool PspMdScreen::Sync()
 {
   if ( m_fbFd < 0 )
@@ -254,250 +848,1758 @@ bool PspMdScreen::Sync()
     return false;
   }
 
-  return ( fsync( m_fbFd ) == 0 );
+  struct timeval before;
+  (void)gettimeofday( &before, NULL );
+  int rt = fsync( m_fbFd );
+
+  PspMdStats & stats = m_md.GetStats();
+  stats.Add( PspMdStats::FSYNC_CALLS );
+  stats.Add( PspMdStats::FSYNC_USEC, elapsedUsec( before ) );
+
+  if ( rt != 0 )
+  {
+    stats.Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_SYNC_FAIL, DEV_FB, errno );
+    return false;
+  }
+
+  if ( m_backBase != NULL )
+    return present();
+
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdMouse
+//-----------------------------------------------------------------------------
+PspMdMouse::PspMdMouse(PspMouseDaemon & md_)
+  : m_md( md_ ),
+    m_deviceCount( 0 ),
+    m_eventCount( 0 ),
+    m_left( false ),
+    m_mid( false ),
+    m_right( false ),
+    m_x( 0 ),
+    m_y( 0 ),
+    m_regionLeft( 0 ),
+    m_regionTop( 0 ),
+    m_regionRight( 0 ),
+    m_regionBottom( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdMouse::~PspMdMouse()
+{
+  for ( int i = 0; i < m_deviceCount; i++ )
+  {
+    if ( m_devices[ i ].fd >= 0 )
+      (void)close( m_devices[ i ].fd );
+  }
+
+  m_deviceCount = 0;
+}
+//-----------------------------------------------------------------------------
+bool PspMdMouse::Initialize
+(
+  const char * const * devNames_,
+  int count_,
+  const int * fds_,
+  int fdCount_
+)
+{
+  if ( m_deviceCount > 0 )
+  {
+    DBG(( DBG_PREFIX "PspMdMouse has been initialized\n" ));
+    return true;
+  }
+
+  // Devices handed over by a previous instance replace the names, they
+  // are the ones that instance still had open
+  if ( fdCount_ > 0 )
+    count_ = fdCount_;
+
+  // A device missing at startup, say a USB mouse not plugged in, is left
+  // out. The pointer needs only one.
+  for ( int i = 0; i < count_ && m_deviceCount < MAX_DEVICES; i++ )
+  {
+    const int fd = ( fdCount_ > 0 ) ? fds_[ i ]
+                                    : open( devNames_[ i ], O_RDONLY );
+    if ( fd < 0 )
+    {
+      m_md.GetRecorder().Record( EVT_OPEN_FAIL, DEV_MOUSE, errno, i );
+      DBG(( DBG_PREFIX "Failed to open mouse driver %s, err=%d\n",
+            devNames_[ i ], errno ));
+      continue;
+    }
+
+    Device & device = m_devices[ m_deviceCount++ ];
+    device.fd = fd;
+    device.partialSize = 0;
+    device.buttons = 0;
+    device.carryX = 0;
+    device.carryY = 0;
+  }
+
+  return m_deviceCount > 0;
+}
+//-----------------------------------------------------------------------------
+void PspMdMouse::SaveDevices(PspMdHandoffState & state_) const
+{
+  // Only the devices still open go over, in order
+  state_.deviceCount = 0;
+  for ( int i = 0; i < m_deviceCount; i++ )
+  {
+    const Device & device = m_devices[ i ];
+    if ( device.fd < 0 )
+      continue;
+
+    PspMdHandoffDevice & saved = state_.devices[ state_.deviceCount++ ];
+    memcpy( saved.partial, device.partial, sizeof( device.partial ) );
+    saved.partialSize = device.partialSize;
+    saved.buttons = device.buttons;
+    saved.carryX = device.carryX;
+    saved.carryY = device.carryY;
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMdMouse::RestoreDevices(const PspMdHandoffState & state_)
+{
+  for ( int i = 0; i < m_deviceCount && i < state_.deviceCount; i++ )
+  {
+    Device & device = m_devices[ i ];
+    const PspMdHandoffDevice & saved = state_.devices[ i ];
+    memcpy( device.partial, saved.partial, sizeof( device.partial ) );
+    device.partialSize = saved.partialSize;
+    device.buttons = saved.buttons;
+    device.carryX = saved.carryX;
+    device.carryY = saved.carryY;
+
+    if ( device.partialSize < 0 ||
+         device.partialSize >= c_mouseInfoSize )
+    {
+      device.partialSize = 0;
+    }
+  }
+
+  unsigned int buttons = 0;
+  for ( int i = 0; i < m_deviceCount; i++ )
+    buttons |= m_devices[ i ].buttons;
+
+  m_left  = ( buttons & BUTTON_LEFT );
+  m_mid   = ( buttons & BUTTON_MID );
+  m_right = ( buttons & BUTTON_RIGHT );
+}
+//-----------------------------------------------------------------------------
+bool PspMdMouse::SetAcceleration(int speed_, int accel_, int threshold_)
+{
+  return m_accel.Build( speed_, accel_, threshold_ );
+}
+//-----------------------------------------------------------------------------
+bool PspMdMouse::SetRegion(int left_, int top_, int right_, int bottom_)
+{
+  if ( right_ < left_ || bottom_ < top_ )
+  {
+    DBG(( DBG_PREFIX "Invalid mouse region\n" ));
+    return false;
+  }
+
+  m_regionLeft   = left_;
+  m_regionTop    = top_;
+  m_regionRight  = right_;
+  m_regionBottom = bottom_;
+
+  m_x = ( m_regionLeft + m_regionRight ) / 2;
+  m_y = ( m_regionTop + m_regionBottom ) / 2;
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdMouse::Poll(unsigned int ready_)
+{
+  m_eventCount = 0;
+
+  // All the devices that woke the daemon make one batch
+  int packets = 0;
+  bool polled = false;
+  for ( int i = 0; i < m_deviceCount; i++ )
+  {
+    if ( ( ready_ & ( 1 << i ) ) && pollDevice( i, packets ) )
+      polled = true;
+  }
+
+  m_md.GetStats().Add( PspMdStats::PACKETS_READ, packets );
+  m_md.GetStats().Add( PspMdStats::PACKETS_COALESCED, packets - m_eventCount );
+
+  // A release made up for a lost device is served like any other event
+  return polled || m_eventCount > 0;
+}
+//-----------------------------------------------------------------------------
+bool PspMdMouse::pollDevice(int index_, int & packets_)
+{
+  Device & device = m_devices[ index_ ];
+  if ( device.fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Tried to poll an invalid mouse device\n" ));
+    return false;
+  }
+
+  // read is blocked until a mouse event is generated, then takes whatever
+  // else has been queued behind it
+  char info[ EVENT_BATCH * c_mouseInfoSize ];
+  memcpy( info, device.partial, device.partialSize );
+
+  int rt = read( device.fd,
+                 info + device.partialSize,
+                 sizeof( info ) - device.partialSize );
+  if ( rt <= 0 )
+  {
+    m_md.GetStats().Add( PspMdStats::DEVICE_ERRORS );
+    m_md.GetRecorder().Record( EVT_READ_FAIL, DEV_MOUSE, errno, index_ );
+    DBG(( DBG_PREFIX "Failed to read from mouse device, err=%d\n", rt ));
+
+    // A failing device would wake every poll with POLLERR, so anything but
+    // an interrupted read drops it. Its buttons are released.
+    if ( rt == 0 || ( errno != EINTR && errno != EAGAIN ) )
+    {
+      (void)close( device.fd );
+      device.fd = INVALID_FD;
+      if ( device.buttons != 0 )
+      {
+        device.buttons = 0;
+        addEvent();
+      }
+    }
+    return false;
+  }
+
+  const int size = device.partialSize + rt;
+  const int packets = size / c_mouseInfoSize;
+  device.partialSize = size - packets * c_mouseInfoSize;
+  memcpy( device.partial, info + packets * c_mouseInfoSize,
+          device.partialSize );
+
+  for ( int i = 0; i < packets; i++ )
+  {
+    const char * packet = info + i * c_mouseInfoSize;
+    const unsigned int bits = (unsigned int)( packet[ 0 ] ) & c_mouseBtnMask;
+    device.buttons = ( ( bits & c_mouseBtnLeft ) ? BUTTON_LEFT : 0 ) |
+                     ( ( bits & c_mouseBtnMid ) ? BUTTON_MID : 0 ) |
+                     ( ( bits & c_mouseBtnRight ) ? BUTTON_RIGHT : 0 );
+
+    SetPos( m_x + m_accel.Apply( (signed char)packet[ 1 ], device.carryX ),
+            m_y + m_accel.Apply( (signed char)packet[ 2 ], device.carryY ) );
+    addEvent();
+  }
+
+  packets_ += packets;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdMouse::addEvent()
+{
+  // A button is down while any device holds it
+  unsigned int buttons = 0;
+  for ( int i = 0; i < m_deviceCount; i++ )
+    buttons |= m_devices[ i ].buttons;
+
+  m_left  = ( buttons & BUTTON_LEFT );
+  m_mid   = ( buttons & BUTTON_MID );
+  m_right = ( buttons & BUTTON_RIGHT );
+
+  // Motion between button changes only matters at its end
+  if ( m_eventCount == 0 ||
+       m_events[ m_eventCount - 1 ].buttons != buttons )
+  {
+    m_events[ m_eventCount++ ].buttons = buttons;
+  }
+
+  m_events[ m_eventCount - 1 ].x = m_x;
+  m_events[ m_eventCount - 1 ].y = m_y;
+}
+//-----------------------------------------------------------------------------
+void PspMdMouse::SetPos(int x_, int y_)
+{
+  if ( x_ < m_regionLeft )
+    m_x = m_regionLeft;
+  else if ( x_ > m_regionRight )
+    m_x = m_regionRight;
+  else
+    m_x = x_;
+
+  if ( y_ < m_regionTop )
+    m_y = m_regionTop;
+  else if ( y_ > m_regionBottom )
+    m_y = m_regionBottom;
+  else
+    m_y = y_;
+}
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMouseDaemon
+//-----------------------------------------------------------------------------
+PspMouseDaemon::PspMouseDaemon()
+  : m_console( *this ),
+    m_screen( *this ),
+    m_mouse( *this ),
+    m_pointer( m_screen ),
+    m_col( 0 ),
+    m_row( 0 ),
+    m_consoleSize( 0 ),
+    m_codes( NULL ),
+    m_state( STATE_FAILED ),
+    m_selection( *this ),
+    m_buttons( 0 ),
+    m_eventX( 0 ),
+    m_eventY( 0 ),
+    m_clickMsec( 0 ),
+    m_clickPos( -1 ),
+    m_clickCount( 0 ),
+    m_scrollY( 0 ),
+    m_dirty( false ),
+    m_idle( false ),
+    m_inputMsec( 0 ),
+    m_geometryMsec( 0 ),
+    m_takenOver( false ),
+    m_handedOff( false )
+{
+  (void)gettimeofday( &m_launchTime, NULL );
+}
+//-----------------------------------------------------------------------------
+PspMouseDaemon::~PspMouseDaemon()
+{
+  delete[] m_codes;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Initialize(const PspMdOptions & options_)
+{
+  m_options = options_;
+  if ( m_options.mouseCount == 0 )
+  {
+    m_options.mice[ 0 ] = c_mouseDevName;
+    m_options.mouseCount = 1;
+  }
+
+  // The recorder goes first so that initialization failures are captured
+  (void)m_recorder.Initialize( c_recFileName );
+
+  // The running instance lends its devices and waits while this one sets
+  // up on them. It lets go of its sockets and shared files only once this
+  // one is ready to serve, those are opened last.
+  if ( m_options.handoff && !takeOver() )
+    return false;
+
+  int mice[ PspMdMouse::MAX_DEVICES ];
+  int miceCount = 0;
+  for ( int i = 0; i < m_handoff.GetState().deviceCount; i++ )
+  {
+    const int fd = m_handoff.TakeFd( PSPMD_HANDOFF_FD_MOUSE + i );
+    if ( fd >= 0 )
+      mice[ miceCount++ ] = fd;
+  }
+
+  // Left to the handoff to close when this instance takes no batches
+  const int controlFd = m_options.control ?
+                        m_handoff.TakeFd( PSPMD_HANDOFF_FD_CONTROL ) :
+                        INVALID_FD;
+
+  // Without the segment the daemon starts afresh, as it used to. The
+  // instance handing off is blocked until this one is ready, the segment
+  // is shared with it until then.
+  if ( m_options.persist )
+    (void)m_persist.Initialize( c_stateFileName, m_handoff.GetState().pid );
+
+  if ( !m_console.Initialize( m_handoff.TakeFd( PSPMD_HANDOFF_FD_VCS ),
+                              m_handoff.TakeFd( PSPMD_HANDOFF_FD_VCSU ) ) ||
+       !m_screen.Initialize( m_handoff.TakeFd( PSPMD_HANDOFF_FD_FB ),
+                             m_options.lowLatency,
+                             m_options.doubleBuffer ) ||
+       !m_mouse.Initialize( m_options.mice, m_options.mouseCount,
+                            mice, miceCount ) ||
+       !m_mouse.SetAcceleration( m_options.accelSpeed,
+                                 m_options.accelFactor,
+                                 m_options.accelThreshold ) ||
+       ( m_options.alpha > 0 &&
+         !m_blend.Initialize( m_screen.GetBytesPerPixel(),
+                              m_screen.MakePixel( c_tintRgb ),
+                              m_options.alpha ) ) ||
+       ( m_options.arenaKb >= 0 && !reserveArena() ) ||
+       !buildGeometry( false ) ||
+       !chooseRenderer() ||
+       ( m_options.pointer && !m_pointer.Initialize() ) ||
+       ( m_options.lowLatency && !enterLowLatency() ) ||
+       ( m_takenOver && !completeTakeover() ) ||
+       ( m_options.service && !m_ring.Initialize( c_ringFileName ) ) ||
+       ( m_options.control &&
+         !m_control.Initialize( c_controlFileName, controlFd ) ) ||
+       ( m_options.handoff && !m_handoff.Listen( c_handoffFileName ) ) )
+  {
+    return false;
+  }
+
+  m_ring.SetGeometry( m_screen.GetWidth(), m_screen.GetHeight(),
+                      m_console.GetCols(), m_console.GetRows() );
+
+  // Stats are informative only, the daemon keeps running without them
+  (void)m_stats.Initialize( c_statsFileName );
+
+  if ( m_options.footprint )
+    reportFootprint();
+
+  // Clean up after a previous instance and take over where it stopped.
+  // One that handed over has cleaned up itself and sent a fresher state.
+  if ( m_takenOver )
+    applyTakeover();
+  else
+    restoreState();
+
+  if ( m_attr.IsEnabled() )
+    m_attr.Attach( m_persist );
+
+  // Start from Cursor state
+  changeState( STATE_CURSOR );
+  (void)sync();
+
+  m_stats.Add( PspMdStats::STARTUP_USEC, elapsedUsec( m_launchTime ) );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::reserveArena()
+{
+  // Every buffer scales with the console, the blend shadow with the screen.
+  // Copies longer than the region allows are cut short rather than taken
+  // from the heap.
+  const int cols = m_console.GetCols();
+  const int rows = m_console.GetRows();
+  const int width = m_screen.GetWidth();
+  const int height = m_screen.GetHeight();
+
+  int size = m_options.arenaKb * 1024;
+  if ( size == 0 )
+  {
+    size = cols * rows * c_arenaCellBytes +
+           ( cols + rows ) * c_arenaLineBytes +
+           ( width + height ) * (int)sizeof( unsigned short );
+    if ( m_options.alpha > 0 )
+      size += width * height * m_screen.GetBytesPerPixel();
+
+    size += size * c_arenaHeadroom / 100 + c_arenaFixedBytes;
+  }
+
+  if ( !m_arena.Initialize( size ) )
+  {
+    m_recorder.Record( EVT_ALLOC_FAIL, size );
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::reportFootprint()
+{
+  // Buffers first, then what the daemon holds in place: the recorder, the
+  // event and control buffers are members, the ring is a shared mapping
+  m_arena.Report();
+  printf( "%-12s %10u\n", "daemon", (unsigned int)sizeof( *this ) );
+  printf( "%-12s %10u\n", "recorder", (unsigned int)sizeof( m_recorder ) );
+  printf( "%-12s %10u\n", "control", (unsigned int)sizeof( m_control ) );
+  printf( "%-12s %10u\n", "input", (unsigned int)sizeof( m_mouse ) );
+  if ( m_ring.IsEnabled() )
+    printf( "%-12s %10d\n", "ring", m_ring.GetMappedSize() );
+  if ( m_persist.IsEnabled() )
+    printf( "%-12s %10d\n", "state", m_persist.GetMappedSize() );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::restoreState()
+{
+  if ( !m_persist.IsRestored() )
+    return;
+
+  const int erased = eraseStale();
+
+  int x, y;
+  m_persist.GetPointer( x, y );
+  m_mouse.SetPos( x, y );
+  screenToConsole( m_mouse.GetX(), m_mouse.GetY(), m_col, m_row );
+
+  if ( !m_persist.RestoreClipboard( m_clipboard ) )
+    m_recorder.Record( EVT_ALLOC_FAIL, PSPMD_STATE_CLIPBOARD );
+
+  int from, to;
+  bool block;
+  if ( m_persist.GetSelection( from, to, block ) )
+    m_selection.Restore( from, to, block );
+
+  m_recorder.Record( EVT_RESTORE, erased, m_clipboard.GetSize() );
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::takeOver()
+{
+  // Nobody listening is a plain start
+  if ( !m_handoff.Connect( c_handoffFileName ) )
+    return true;
+
+  // Answered between two batches of the running instance. From here on a
+  // failure leaves it running and this one gives up, two daemons must not
+  // share the devices.
+  const PspMdHandoffState & state = m_handoff.GetState();
+  if ( !m_handoff.Receive() ||
+       state.recordsSize != m_recorder.GetRecordsSize() ||
+       !m_handoff.Read( m_recorder.Adopt( state.recNextSeq,
+                                          state.recStartSec ),
+                        state.recordsSize ) )
+  {
+    m_recorder.Record( EVT_HANDOFF_FAIL, state.recordsSize );
+    return false;
+  }
+
+  for ( int size = state.clipboardSize; size > 0; )
+  {
+    const int len = ( size < PspMdClipboard::CHUNK_SIZE ) ?
+                    size : PspMdClipboard::CHUNK_SIZE;
+    char * text = m_clipboard.Extend( len );
+    if ( text == NULL || !m_handoff.Read( text, len ) )
+    {
+      m_recorder.Record( EVT_HANDOFF_FAIL, state.clipboardSize );
+      return false;
+    }
+
+    size -= len;
+  }
+
+  m_takenOver = true;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::completeTakeover()
+{
+  // Everything but the files the old instance holds is in place. It exits
+  // once acknowledged; should it have given up or hang instead, both would
+  // serve the devices, so this one stops.
+  if ( !m_handoff.Acknowledge() || !m_handoff.WaitRelease() )
+  {
+    m_recorder.Record( EVT_HANDOFF_FAIL, -1 );
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::applyTakeover()
+{
+  const PspMdHandoffState & state = m_handoff.GetState();
+
+  // Packets split across reads and buttons held go on where they were
+  m_mouse.RestoreDevices( state );
+  m_mouse.SetPos( state.x, state.y );
+  screenToConsole( m_mouse.GetX(), m_mouse.GetY(), m_col, m_row );
+  m_buttons = state.buttons;
+
+  if ( state.selFrom <= state.selTo )
+    m_selection.Restore( state.selFrom, state.selTo, state.selBlock != 0 );
+
+  // The count goes on, a packet lost in between shows as a gap in the
+  // flight recorder rather than here
+  m_stats.Add( PspMdStats::PACKETS_READ, state.packetsRead );
+  m_recorder.Record( EVT_TAKEOVER, state.packetsRead, state.fdCount,
+                     state.clipboardSize );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::handOff()
+{
+  // A drag in progress finishes first, the next wakeup asks again
+  if ( m_state != STATE_CURSOR || !m_handoff.Accept() )
+    return;
+
+  // The next instance draws the overlay afresh
+  hideOverlay();
+  (void)sync();
+
+  PspMdHandoffState state;
+  memset( &state, 0, sizeof( state ) );
+  state.magic = PSPMD_HANDOFF_MAGIC;
+  state.version = PSPMD_HANDOFF_VERSION;
+  state.pid = getpid();
+
+  int fds[ PSPMD_HANDOFF_FDS ];
+  int count = 0;
+  fds[ count ] = m_console.GetFd();
+  state.fdKinds[ count++ ] = PSPMD_HANDOFF_FD_VCS;
+  if ( m_console.GetCodesFd() >= 0 )
+  {
+    fds[ count ] = m_console.GetCodesFd();
+    state.fdKinds[ count++ ] = PSPMD_HANDOFF_FD_VCSU;
+  }
+  fds[ count ] = m_screen.GetFd();
+  state.fdKinds[ count++ ] = PSPMD_HANDOFF_FD_FB;
+  if ( m_control.IsEnabled() )
+  {
+    fds[ count ] = m_control.GetFd();
+    state.fdKinds[ count++ ] = PSPMD_HANDOFF_FD_CONTROL;
+  }
+
+  // Same order as SaveDevices(), open devices only
+  m_mouse.SaveDevices( state );
+  for ( int i = 0, j = 0; i < m_mouse.GetDeviceCount(); i++ )
+  {
+    if ( m_mouse.GetFd( i ) < 0 )
+      continue;
+
+    fds[ count ] = m_mouse.GetFd( i );
+    state.fdKinds[ count++ ] = PSPMD_HANDOFF_FD_MOUSE + j++;
+  }
+  state.fdCount = count;
+
+  state.x = m_mouse.GetX();
+  state.y = m_mouse.GetY();
+  state.buttons = m_buttons;
+
+  int from, to;
+  if ( !m_selection.IsScrolled() && m_selection.GetSpan( from, to ) )
+  {
+    state.selFrom = from;
+    state.selTo = to;
+    state.selBlock = m_selection.IsBlock();
+  }
+  else
+  {
+    state.selFrom = 0;
+    state.selTo = -1;
+  }
+
+  // Recorded before the ring is sent, so the dump of the next instance
+  // shows where one stopped and the other started
+  state.packetsRead = m_stats.Get( PspMdStats::PACKETS_READ );
+  m_recorder.Record( EVT_HANDOFF, state.packetsRead, count );
+  state.recNextSeq = m_recorder.GetNextSeq();
+  state.recStartSec = m_recorder.GetStartSec();
+  state.recordsSize = m_recorder.GetRecordsSize();
+  state.clipboardSize = m_clipboard.GetSize();
+
+  bool ok = m_handoff.Send( state, fds ) &&
+            m_handoff.Write( m_recorder.GetRecords(), state.recordsSize );
+  for ( const PspMdClipboard::Chunk * chunk = m_clipboard.GetFirst();
+        ok && chunk != NULL;
+        chunk = chunk->next )
+  {
+    ok = m_handoff.Write( chunk->data, chunk->size );
+  }
+
+  // Released only with the acknowledgement in hand, the next instance
+  // gives up without it
+  if ( !ok || !m_handoff.WaitAcknowledge() || !m_handoff.Release() )
+  {
+    // Carry on as if nothing happened, the devices were only lent
+    m_recorder.Record( EVT_HANDOFF_FAIL, count );
+    m_handoff.Close();
+    showOverlay();
+    (void)sync();
+    return;
+  }
+
+  // Unread packets and batches stay queued for the next instance. The
+  // connection stays open until exit.
+  m_control.Disown();
+  m_handedOff = true;
+}
+//-----------------------------------------------------------------------------
+int PspMouseDaemon::eraseStale()
+{
+  // Attributes the previous instance left swapped go back with the first
+  // sync. When this one draws pixels the device is opened for just that.
+  int erased = 0;
+  if ( m_persist.NextSwapped( 0 ) >= 0 )
+  {
+    if ( m_attr.IsEnabled() )
+    {
+      erased = m_attr.Restore( m_persist );
+    }
+    else if ( m_attr.Initialize( c_vcsaDevName ) &&
+              m_attr.Build( m_console.GetCols(), m_console.GetRows() ) )
+    {
+      erased = m_attr.Restore( m_persist );
+      (void)m_attr.Flush();
+      m_attr.Close();
+    }
+    else
+    {
+      m_attr.Close();
+      m_persist.ClearSwapped();
+    }
+  }
+
+  // Cells the previous instance may have left XORed. The marker bits in
+  // the first pixel tell which still are; a cell the console has redrawn
+  // since has lost them and is left alone.
+  if ( m_screen.GetBytesPerPixel() != sizeof( unsigned int ) )
+    return erased;
+
+  const int cols = m_geometry.GetCols();
+
+  for ( int cell = m_persist.NextMark( 0 );
+        cell >= 0;
+        cell = m_persist.NextMark( cell + 1 ) )
+  {
+    const int row = cell / cols;
+    const int col = cell - row * cols;
+    unsigned int * start = m_geometry.GetCell( col, row );
+
+    const unsigned int code =
+      ( ( *start & c_cursorMask ) ? c_cursorColor : 0 ) ^
+      ( ( *start & c_highlightMask ) ? c_highlightColor : 0 );
+    if ( code == 0 )
+      continue;
+
+    m_screen.Damage( m_geometry.GetCellY( row ),
+                     m_geometry.GetCellHeight( row ) );
+    (void)m_screen.Xor( start,
+                        m_geometry.GetCellWidth( col ),
+                        m_geometry.GetCellHeight( row ),
+                        code );
+    erased++;
+  }
+
+  m_persist.ClearMarks();
+  if ( erased > 0 )
+    m_dirty = true;
+
+  return erased;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::saveState()
+{
+  if ( !m_persist.IsEnabled() )
+    return;
+
+  m_persist.SetPointer( m_mouse.GetX(), m_mouse.GetY() );
+
+  // Lines scrolled out of view cannot be shown again, such a selection is
+  // not kept
+  int from, to;
+  if ( !m_selection.IsScrolled() && m_selection.GetSpan( from, to ) )
+    m_persist.SetSelection( from, to, m_selection.IsBlock() );
+  else
+    m_persist.SetSelection( 0, -1, false );
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::buildGeometry(bool keepPointer_)
+{
+  // Cell metrics come from the command line, then from the console font.
+  // Without either the screen is partitioned exactly between the cells.
+  int fontWidth = m_options.fontWidth;
+  int fontHeight = m_options.fontHeight;
+  if ( fontWidth == 0 || fontHeight == 0 )
+  {
+    if ( !m_console.GetFontSize( fontWidth, fontHeight ) ||
+         fontWidth * m_console.GetCols() > m_screen.GetWidth() ||
+         fontHeight * m_console.GetRows() > m_screen.GetHeight() )
+    {
+      fontWidth = 0;
+      fontHeight = 0;
+    }
+  }
+
+  if ( !m_geometry.Build( m_screen.GetDrawAddress(),
+                          m_screen.GetLineLength(),
+                          m_screen.GetBytesPerPixel(),
+                          m_screen.GetWidth(),
+                          m_screen.GetHeight(),
+                          m_console.GetCols(),
+                          m_console.GetRows(),
+                          fontWidth,
+                          fontHeight ) )
+  {
+    return false;
+  }
+
+  if ( m_screen.IsDoubleBuffered() )
+  {
+    // Both row tables are built here once, a flip only swaps them. The
+    // console may have been redrawn as a whole, the back page starts over
+    // from the page shown.
+    m_geometry.Rebase( m_screen.GetDrawAddress(), m_screen.GetAddress() );
+    if ( !m_pages.Resize( m_console.GetCols(), m_console.GetRows() ) )
+      return false;
+
+    m_screen.CopyFront( 0, m_screen.GetHeight() );
+    (void)m_pages.Capture( m_console );
+  }
+
+  if ( !m_blend.Build( m_screen.GetWidth(),
+                       m_screen.GetHeight(),
+                       m_console.GetCols() * m_console.GetRows() ) )
+  {
+    m_recorder.Record( EVT_ALLOC_FAIL,
+                       m_screen.GetWidth() * m_screen.GetHeight() );
+    return false;
+  }
+
+  if ( !m_attr.Build( m_console.GetCols(), m_console.GetRows() ) )
+  {
+    m_recorder.Record( EVT_ALLOC_FAIL,
+                       m_console.GetCols() * m_console.GetRows() );
+    return false;
+  }
+
+  // The region recenters the pointer, put it back where it was
+  int x = m_mouse.GetX();
+  int y = m_mouse.GetY();
+  if ( !m_mouse.SetRegion( 0, 0,
+                           m_screen.GetWidth() - 1,
+                           m_screen.GetHeight() - 1 ) )
+  {
+    return false;
+  }
+
+  if ( keepPointer_ )
+    m_mouse.SetPos( x, y );
+
+  m_ring.SetGeometry( m_screen.GetWidth(), m_screen.GetHeight(),
+                      m_console.GetCols(), m_console.GetRows() );
+
+  PspMdLayout layout;
+  layout.width = m_screen.GetWidth();
+  layout.height = m_screen.GetHeight();
+  layout.lineLength = m_screen.GetLineLength();
+  layout.bytesPerPixel = m_screen.GetBytesPerPixel();
+  layout.cols = m_console.GetCols();
+  layout.rows = m_console.GetRows();
+  layout.cellWidth = m_geometry.GetCellWidth( 0 );
+  layout.cellHeight = m_geometry.GetCellHeight( 0 );
+  m_persist.SetLayout( layout );
+
+  screenToConsole( m_mouse.GetX(), m_mouse.GetY(), m_col, m_row );
+
+  return m_selection.Resize( m_console.GetCols() ) &&
+         m_snapshot.Resize( m_console.GetCols(), m_console.GetRows() ) &&
+         m_search.Resize( m_console.GetCols(), m_console.GetRows() ) &&
+         resizeClipboard();
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::checkGeometry(bool changed_)
+{
+  // Three ioctls, the fb ones copy the whole mode. They run when the
+  // console signals a change, otherwise at most every c_geometryMsec for
+  // drivers that never signal, and not for every batch of a drag.
+  const unsigned int now = m_recorder.GetMsec();
+  if ( !changed_ && now - m_geometryMsec < c_geometryMsec )
+    return true;
+
+  m_geometryMsec = now;
+
+  bool remapped, resized, consoleResized;
+  int cols, rows;
+
+  if ( !m_screen.Refresh( remapped, resized ) &&
+       m_screen.GetAddress() == NULL )
+  {
+    // Lost the framebuffer mapping, nothing can be drawn any more
+    return false;
+  }
+
+  (void)m_console.Refresh( cols, rows, consoleResized );
+
+  if ( remapped )
+  {
+    // Whatever was under the arrow and the tint has moved with the console
+    m_pointer.Discard();
+    m_blend.Discard();
+
+    if ( !resized )
+      m_geometry.Rebase( m_screen.GetDrawAddress(),
+                         m_screen.IsDoubleBuffered() ?
+                         m_screen.GetAddress() : NULL );
+  }
+
+  if ( resized || consoleResized )
+  {
+    // After a mode switch the driver has repainted VRAM, so the overlay
+    // is only erased when the old layout is still in place
+    return reloadGeometry( !resized, cols, rows );
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::syncPages()
+{
+  // The console draws on the page shown. The rows it has changed since the
+  // last wakeup go to the back page before anything is drawn there, or the
+  // next flip would bring back the old text.
+  if ( !m_screen.IsDoubleBuffered() || !m_pages.Capture( m_console ) )
+    return;
+
+  const int rows = m_geometry.GetRows();
+  int first = -1;
+  for ( int row = 0; row <= rows; row++ )
+  {
+    if ( row < rows && m_pages.HasRowChanged( row ) )
+    {
+      if ( first < 0 )
+        first = row;
+      continue;
+    }
+
+    if ( first >= 0 )
+    {
+      const int y = m_geometry.GetCellY( first );
+      m_screen.CopyFront( y, m_geometry.GetCellY( row - 1 ) +
+                             m_geometry.GetCellHeight( row - 1 ) - y );
+      first = -1;
+    }
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::reloadGeometry(bool eraseOverlay_, int cols_, int rows_)
+{
+  m_recorder.Record( EVT_GEOMETRY,
+                     cols_,
+                     rows_,
+                     ( m_screen.GetWidth() << 16 ) | m_screen.GetHeight() );
+
+  // The overlay is erased through the tables of the old size, the console
+  // only takes the new one when they are rebuilt
+  // The erase is shown before the rebuild, so that both pages agree when
+  // the back page is brought up to date
+  if ( eraseOverlay_ )
+  {
+    hideOverlay();
+    (void)sync();
+  }
+
+  m_console.Resize( cols_, rows_ );
+
+  if ( !buildGeometry( true ) )
+    return false;
+
+  m_selection.Clamp();
+  showOverlay();
+  (void)sync();
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::resizeClipboard()
+{
+  const int size = m_console.GetCols() * m_console.GetRows();
+
+  // A screenful with a line break per row is copied without allocating,
+  // longer selections grow the clipboard as they go. The content survives
+  // a resize.
+  if ( !m_clipboard.Prepare( size + m_console.GetRows() ) )
+  {
+    m_recorder.Record( EVT_ALLOC_FAIL, size + m_console.GetRows() );
+    return false;
+  }
+
+  if ( m_console.HasCodes() && size != m_consoleSize )
+  {
+    PspMdArena::Scope scope( PspMdArena::TAG_CODES );
+    delete[] m_codes;
+    m_codes = new unsigned int[ size ];
+    if ( m_codes == NULL )
+    {
+      m_recorder.Record( EVT_ALLOC_FAIL, size * sizeof( unsigned int ) );
+      return false;
+    }
+  }
+
+  m_consoleSize = size;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::waitEvents
+(
+  unsigned int & input_,
+  bool & control_,
+  bool & console_,
+  bool & handoff_
+)
+{
+  input_ = 0;
+  control_ = false;
+  console_ = false;
+  handoff_ = false;
+
+  // Devices that are gone keep their slot with a negative fd, which poll
+  // skips
+  struct pollfd fds[ PspMdMouse::MAX_DEVICES + 3 ];
+  const int mice = m_mouse.GetDeviceCount();
+  int count;
+  for ( count = 0; count < mice; count++ )
+  {
+    fds[ count ].fd = m_mouse.GetFd( count );
+    fds[ count ].events = POLLIN;
+    fds[ count ].revents = 0;
+  }
+
+  const int control = count;
+  if ( m_control.IsEnabled() )
+  {
+    fds[ count ].fd = m_control.GetFd();
+    fds[ count ].events = POLLIN;
+    fds[ count ].revents = 0;
+    count++;
+  }
+
+  // A handoff is only answered with the cursor at rest, a pending one
+  // waits out a drag without waking the loop
+  const int handoff = count;
+  const bool listening = m_handoff.IsListening() && m_state == STATE_CURSOR;
+  if ( listening )
+  {
+    fds[ count ].fd = m_handoff.GetFd();
+    fds[ count ].events = POLLIN;
+    fds[ count ].revents = 0;
+    count++;
+  }
+
+  // Console changes only matter while a selection or matches are shown.
+  // POLLPRI is raised by vcs drivers that notify about updates, others
+  // never wake.
+  const int console = count;
+  const bool watching = !m_selection.IsEmpty() || m_search.IsActive();
+  if ( watching )
+  {
+    fds[ count ].fd = m_console.GetFd();
+    fds[ count ].events = POLLPRI;
+    fds[ count ].revents = 0;
+    count++;
+  }
+
+  int rt = poll( fds, count, idleTimeout() );
+  if ( rt < 0 )
+  {
+    if ( errno == EINTR )
+      return true;
+
+    m_recorder.Record( EVT_READ_FAIL, DEV_MOUSE, errno, rt );
+    DBG(( DBG_PREFIX "Failed to wait for events, err=%d\n", errno ));
+    return false;
+  }
+
+  // The snapshot is taken on every wakeup, a console change only brings
+  // the geometry check forward
+  for ( int i = 0; i < mice; i++ )
+  {
+    if ( fds[ i ].revents != 0 )
+      input_ |= 1 << i;
+  }
+
+  control_ = ( m_control.IsEnabled() && fds[ control ].revents != 0 );
+  console_ = ( watching && ( fds[ console ].revents & POLLPRI ) != 0 );
+  handoff_ = ( listening && fds[ handoff ].revents != 0 );
+  return true;
+}
+//-----------------------------------------------------------------------------
+int PspMouseDaemon::idleTimeout() const
+{
+  // The only timer there is: it is armed while the cursor is shown and
+  // waiting for input. Once idle the daemon sleeps until a device wakes it.
+  if ( m_options.idleSec == 0 || m_idle || m_state != STATE_CURSOR )
+    return -1;
+
+  const int elapsed = (int)( m_recorder.GetMsec() - m_inputMsec );
+  const int period = m_options.idleSec * 1000;
+  return ( elapsed < period ) ? period - elapsed : 0;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::trackIdle(bool input_)
+{
+  if ( input_ )
+  {
+    m_inputMsec = m_recorder.GetMsec();
+
+    // The cursor comes back before the batch is served, so the same sync
+    // shows it at its new place
+    if ( m_idle )
+    {
+      m_idle = false;
+      if ( m_state == STATE_CURSOR )
+        (void)draw( m_col, m_row, true, false );
+    }
+    return;
+  }
+
+  if ( idleTimeout() != 0 )
+    return;
+
+  // Off the console, nothing is left to collide with its repaints
+  m_idle = true;
+  m_recorder.Record( EVT_IDLE, m_col, m_row );
+  (void)clear( m_col, m_row, true, false );
+  m_pointer.Hide();
+  m_stats.ResetRates();
+  (void)m_stats.Export( true );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::serveControl()
+{
+  // Batches queued since the last wakeup are served in one go
+  while ( m_state != STATE_FAILED && m_control.Receive() )
+  {
+    const PspMdCtlHeader & header = m_control.GetHeader();
+    unsigned int accepted = 0;
+    unsigned int processed = 0;
+    int status = PSPMD_CTL_OK;
+    struct timeval start;
+    (void)gettimeofday( &start, NULL );
+
+    switch ( header.command )
+    {
+    case PSPMD_CTL_EVENTS:
+      if ( header.count * sizeof( PspMdCtlMotion ) >
+           (unsigned int)m_control.GetPayloadSize() )
+      {
+        status = PSPMD_CTL_BAD_REQUEST;
+        break;
+      }
+
+      accepted = injectMotions(
+                   (const PspMdCtlMotion *)m_control.GetPayload(),
+                   header.count,
+                   processed );
+      break;
+
+    case PSPMD_CTL_SELECT:
+      if ( m_control.GetPayloadSize() < (int)sizeof( PspMdCtlSelect ) ||
+           !injectSelect( *(const PspMdCtlSelect *)m_control.GetPayload() ) )
+      {
+        status = PSPMD_CTL_BAD_REQUEST;
+        break;
+      }
+
+      accepted = 1;
+      processed = 1;
+      break;
+
+    case PSPMD_CTL_COPY:
+      if ( m_selection.IsEmpty() )
+      {
+        status = PSPMD_CTL_FAILED;
+        break;
+      }
+
+      m_selection.Copy();
+      accepted = 1;
+      processed = 1;
+      break;
+
+    case PSPMD_CTL_PASTE:
+      accepted = 1;
+      if ( !pasteCb() )
+      {
+        status = PSPMD_CTL_FAILED;
+        break;
+      }
+
+      processed = 1;
+      break;
+
+    default:
+      status = PSPMD_CTL_BAD_REQUEST;
+      break;
+    }
+
+    // The batch is timed to the end of its redraw
+    if ( m_dirty )
+      (void)sync();
+
+    m_stats.Add( PspMdStats::CONTROL_BATCHES );
+    m_stats.Add( PspMdStats::CONTROL_EVENTS, processed );
+    m_recorder.Record( EVT_CONTROL, header.seq, accepted, processed );
+    (void)m_control.Reply( status, accepted, processed, elapsedUsec( start ) );
+  }
+}
+//-----------------------------------------------------------------------------
+int PspMouseDaemon::injectMotions
+(
+  const PspMdCtlMotion * motions_,
+  int count_,
+  unsigned int & processed_
+)
+{
+  // Motions become events the way mouse packets do, except that every
+  // one is kept
+  PspMdEvent events[ PspMdMouse::EVENT_BATCH ];
+  const unsigned int validButtons = PspMdMouse::BUTTON_LEFT |
+                                    PspMdMouse::BUTTON_MID |
+                                    PspMdMouse::BUTTON_RIGHT;
+  int accepted = 0;
+  int count = 0;
+  processed_ = 0;
+
+  for ( int i = 0; i < count_; i++ )
+  {
+    if ( motions_[ i ].buttons & ~validButtons )
+      continue;
+
+    m_mouse.SetPos( m_mouse.GetX() + motions_[ i ].dx,
+                    m_mouse.GetY() + motions_[ i ].dy );
+    events[ count ].buttons = motions_[ i ].buttons;
+    events[ count ].x = m_mouse.GetX();
+    events[ count ].y = m_mouse.GetY();
+    accepted++;
+
+    if ( ++count == PspMdMouse::EVENT_BATCH )
+    {
+      if ( m_state == STATE_FAILED )
+        break;
+
+      serveEvents( events, count );
+      processed_ += count;
+      count = 0;
+    }
+  }
+
+  if ( count > 0 && m_state != STATE_FAILED )
+  {
+    serveEvents( events, count );
+    processed_ += count;
+  }
+
+  return accepted;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::injectSelect(const PspMdCtlSelect & select_)
+{
+  if ( select_.fromCol < 0 || select_.fromCol >= m_geometry.GetCols() ||
+       select_.fromRow < 0 || select_.fromRow >= m_geometry.GetRows() ||
+       select_.toCol < 0 || select_.toCol >= m_geometry.GetCols() ||
+       select_.toRow < 0 || select_.toRow >= m_geometry.GetRows() )
+  {
+    return false;
+  }
+
+  // Buttons up, press on the first cell, drag to the last and release. A
+  // press never counts as a second click of an earlier one.
+  PspMdEvent events[ 4 ];
+  events[ 0 ].buttons = 0;
+  events[ 0 ].x = m_geometry.GetCellX( select_.fromCol );
+  events[ 0 ].y = m_geometry.GetCellY( select_.fromRow );
+  events[ 1 ] = events[ 0 ];
+  events[ 1 ].buttons = PspMdMouse::BUTTON_LEFT;
+  events[ 2 ].buttons = PspMdMouse::BUTTON_LEFT;
+  events[ 2 ].x = m_geometry.GetCellX( select_.toCol );
+  events[ 2 ].y = m_geometry.GetCellY( select_.toRow );
+  events[ 3 ] = events[ 2 ];
+  events[ 3 ].buttons = 0;
+
+  m_clickPos = -1;
+  m_mouse.SetPos( events[ 3 ].x, events[ 3 ].y );
+  serveEvents( events, 4 );
+  return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMdScreen::Xor
-(
-  int x_,
-  int y_,
-  int width_,
-  int height_,
-  unsigned int code_
-)
+bool PspMouseDaemon::captureConsole()
 {
-  if ( m_vramBase == NULL )
+  // While a selection holds the view in the scrollback, the text moves
+  // because of the selection itself
+  if ( ( m_selection.IsEmpty() && !m_search.IsActive() ) ||
+       m_selection.IsScrolled() )
   {
-    DBG(( DBG_PREFIX "Tried to draw on an invalid device\n" ));
+    m_snapshot.Invalidate();
     return false;
   }
 
-  unsigned int * p = m_vramBase + x_ + y_ * m_virtualWidth;
-  for ( int i = 0; i < height_; i++ )
+  return m_snapshot.Capture( m_console );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::trackScroll()
+{
+  const int rows = m_snapshot.FindScroll();
+  if ( rows <= 0 )
+    return;
+
+  m_recorder.Record( EVT_SCROLL_TRACKED, rows );
+
+  // Everything drawn went up with the text
+  const int dy = m_geometry.GetCellY( rows );
+  m_pointer.Scroll( dy );
+  m_blend.Scroll( dy, rows * m_geometry.GetCols() );
+  m_attr.Scroll( rows * m_geometry.GetCols() );
+  m_search.Shift( rows * m_geometry.GetCols() );
+
+  // The cursor went up too, matches alone scroll it as well. clear() goes
+  // by the marker bits and leaves a cell without it alone.
+  if ( m_row >= rows )
+    (void)clear( m_col, m_row - rows, true, false );
+
+  if ( !m_selection.IsEmpty() )
   {
-    for ( int j = 0; j < width_; j++ )
-      p[ j ] ^= code_;
+    m_selection.Shift( rows );
 
-    p += m_virtualWidth;
+    if ( isSelecting( m_state ) )
+    {
+      m_selection.Extend( m_col, m_row );
+      return;
+    }
   }
 
-  return true;
+  if ( ( m_state == STATE_CURSOR && !m_idle ) || isSelecting( m_state ) )
+    (void)draw( m_col, m_row, true, false );
 }
-
-
-//-----------------------------------------------------------------------------
-// Class: PspMdMouse
 //-----------------------------------------------------------------------------
-PspMdMouse::PspMdMouse(PspMouseDaemon & md_)
-  : m_md( md_ ),
-    m_mouseFd( INVALID_FD ),
-    m_left( false ),
-    m_mid( false ),
-    m_right( false ),
-    m_x( 0 ),
-    m_y( 0 ),
-    m_regionLeft( 0 ),
-    m_regionTop( 0 ),
-    m_regionRight( 0 ),
-    m_regionBottom( 0 )
+void PspMouseDaemon::trackMatches()
 {
+  // Any row that changed may have gained or lost an occurrence
+  if ( m_search.IsActive() && m_snapshot.HasChanged() )
+    findMatches();
 }
 //-----------------------------------------------------------------------------
-PspMdMouse::~PspMdMouse()
+void PspMouseDaemon::startSearch()
 {
-  if ( m_mouseFd >= 0 )
+  // Only text from within a row makes a pattern
+  const PspMdClipboard::Chunk * chunk = m_clipboard.GetFirst();
+  if ( chunk == NULL || chunk->next != NULL ||
+       !m_search.SetPattern( chunk->data, chunk->size ) ||
+       !m_snapshot.Capture( m_console ) )
   {
-    (void)close( m_mouseFd );
-    m_mouseFd = INVALID_FD;
+    return;
   }
+
+  findMatches();
 }
 //-----------------------------------------------------------------------------
-bool PspMdMouse::Initialize()
+void PspMouseDaemon::findMatches()
 {
-  if ( m_mouseFd >= 0 )
+  // The selection is the occurrence the pattern came from
+  int from, to;
+  if ( !m_selection.GetSpan( from, to ) )
   {
-    DBG(( DBG_PREFIX "PspMdMouse has been initialized\n" ));
-    return true;
+    from = 0;
+    to = -1;
   }
 
-  m_mouseFd = open( c_mouseDevName, O_RDONLY );
-  if ( m_mouseFd < 0 )
+  hideMatches();
+  (void)m_search.Find( m_snapshot.GetText(), from, to );
+  paintMatches( true );
+  m_stats.Add( PspMdStats::SEARCH_RUNS );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::hideMatches()
+{
+  paintMatches( false );
+  m_search.Forget();
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::paintMatches(bool draw_)
+{
+  const int length = m_search.GetLength();
+  int col, row;
+
+  for ( int i = 0; i < m_search.GetCount(); i++ )
   {
-    DBG(( DBG_PREFIX "Failed to open mouse driver, err=%d\n", m_mouseFd ));
-    return false;
-  }
+    const int pos = m_search.GetMatch( i );
 
-  return true;
+    // A match cut by the top edge starts above the screen
+    for ( int j = ( pos < 0 ) ? -pos : 0; j < length; j++ )
+    {
+      linearToConsole( pos + j, col, row );
+      if ( draw_ ? !draw( col, row, false, true )
+                 : !clear( col, row, false, true ) )
+      {
+        return;
+      }
+    }
+  }
 }
 //-----------------------------------------------------------------------------
-bool PspMdMouse::SetRegion(int left_, int top_, int right_, int bottom_)
+void PspMouseDaemon::hideOverlay()
 {
-  if ( right_ < left_ || bottom_ < top_ )
+  // clear() looks at the marker bits, so a cell without a cursor is kept
+  m_pointer.Hide();
+  (void)clear( m_col, m_row, true, false );
+  m_selection.Hide();
+  hideMatches();
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::showOverlay()
+{
+  m_selection.Show();
+
+  if ( m_search.IsActive() && m_snapshot.Capture( m_console ) )
+    findMatches();
+
+  if ( ( m_state == STATE_CURSOR && !m_idle ) ||
+       ( isSelecting( m_state ) && m_selection.IsEmpty() ) )
   {
-    DBG(( DBG_PREFIX "Invalid mouse region\n" ));
-    return false;
+    (void)draw( m_col, m_row, true, false );
   }
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Run()
+{
+  while ( m_state != STATE_FAILED && !m_handedOff )
+  {
+    unsigned int input;
+    bool control;
+    bool console;
+    bool handoff;
+    if ( !waitEvents( input, control, console, handoff ) ||
+         ( input != 0 && !m_mouse.Poll( input ) ) )
+    {
+      sleep( c_failureDelay );
+      continue;
+    }
 
-  m_regionLeft   = left_;
-  m_regionTop    = top_;
-  m_regionRight  = right_;
-  m_regionBottom = bottom_;
+    m_recorder.Tick();
+    m_stats.Add( PspMdStats::WAKEUPS );
+    syncPages();
+    trackIdle( input != 0 || control );
 
-  m_x = ( m_regionLeft + m_regionRight ) / 2;
-  m_y = ( m_regionTop + m_regionBottom ) / 2;
+    if ( !checkGeometry( console ) )
+    {
+      changeState( STATE_FAILED );
+      continue;
+    }
+
+    // Output may have scrolled the text from under the overlay
+    if ( captureConsole() )
+    {
+      trackScroll();
+      trackMatches();
+    }
+
+    if ( input != 0 )
+      serveEvents( m_mouse.GetEvents(), m_mouse.GetEventCount() );
+
+    if ( control )
+      serveControl();
+
+    // Take the reference for scroll tracking as soon as there is a selection
+    if ( ( !m_selection.IsEmpty() || m_search.IsActive() ) &&
+         !m_snapshot.IsValid() )
+      (void)m_snapshot.Capture( m_console );
+
+    // One redraw for the whole batch. The arrow follows every pixel, not
+    // only cell changes.
+    if ( m_dirty ||
+         ( m_pointer.IsEnabled() && !m_idle &&
+           ( !m_pointer.IsVisible() ||
+             m_pointer.GetX() != m_mouse.GetX() ||
+             m_pointer.GetY() != m_mouse.GetY() ) ) )
+    {
+      (void)sync();
+    }
+
+    saveState();
+    m_stats.Set( PspMdStats::HEAP_ALLOCS, PspMdArena::GetHeapAllocs() );
+    m_stats.Set( PspMdStats::ARENA_BYTES, m_arena.GetUsed() );
+    (void)m_stats.Export();
+
+    // Between two batches, with this one fully served
+    if ( handoff )
+      handOff();
+  }
 
+  m_recorder.Record( EVT_STOP );
+  DBG(( DBG_PREFIX "Mouse daemon terminates\n" ));
   return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMdMouse::Poll()
+bool PspMouseDaemon::Benchmark()
 {
-  if ( m_mouseFd < 0 )
+  // Both renderers run over every cell of the live screen. The XOR passes
+  // come in pairs and every tint is restored, so the console is left as
+  // it was found.
+  if ( m_screen.GetBytesPerPixel() != sizeof( unsigned int ) )
   {
-    DBG(( DBG_PREFIX "Tried to poll an invalid mouse device\n" ));
+    DBG(( DBG_PREFIX "The XOR renderer needs a 32bpp framebuffer\n" ));
     return false;
   }
 
-  // read is blocked until a mouse event is generated
-  char info[ c_mouseInfoSize ];
-  int rt = read( m_mouseFd, info, c_mouseInfoSize );
-  if ( rt != c_mouseInfoSize )
+  if ( !m_blend.IsEnabled() &&
+       ( !m_blend.Initialize( m_screen.GetBytesPerPixel(),
+                              m_screen.MakePixel( c_tintRgb ),
+                              c_benchAlpha ) ||
+         !m_blend.Build( m_screen.GetWidth(),
+                         m_screen.GetHeight(),
+                         m_console.GetCols() * m_console.GetRows() ) ) )
   {
-    DBG(( DBG_PREFIX "Failed to read from mouse device, err=%d\n", rt ));
     return false;
   }
 
-  unsigned int buttons = ( (unsigned int)( info[ 0 ] ) & c_mouseBtnMask );
-  m_left  = ( buttons & c_mouseBtnLeft );
-  m_mid   = ( buttons & c_mouseBtnMid );
-  m_right = ( buttons & c_mouseBtnRight );
+  hideOverlay();
+  (void)m_attr.Flush();
+
+  const int cols = m_geometry.GetCols();
+  const int rows = m_geometry.GetRows();
+  const int passes = m_options.benchPasses;
+  unsigned int xorUsec = 0;
+  unsigned int attrUsec = 0;
+  unsigned int blendUsec = 0;
+  unsigned int restoreUsec = 0;
+  unsigned int searchUsec = 0;
+  unsigned int slowUsec = 0;
+  unsigned int fastUsec = 0;
+  unsigned int copyUsec = 0;
+  unsigned int codesUsec = 0;
+  struct timeval start;
+  int pass, col, row;
+
+  (void)gettimeofday( &start, NULL );
+  for ( pass = 0; pass < 2 * passes; pass++ )
+  {
+    for ( row = 0; row < rows; row++ )
+    {
+      for ( col = 0; col < cols; col++ )
+      {
+        (void)m_screen.Xor( m_geometry.GetCell( col, row ),
+                            m_geometry.GetCellWidth( col ),
+                            m_geometry.GetCellHeight( row ),
+                            c_highlightColor );
+      }
+    }
+  }
+  xorUsec = elapsedUsec( start ) / 2;
 
-  SetPos( m_x + (int)info[ 1 ],
-          m_y + (int)info[ 2 ] );
+  // The attribute renderer draws and clears every row, the driver
+  // redrawing the glyphs each time
+  PspMdAttr attr;
+  if ( attr.Initialize( c_vcsaDevName ) && attr.Build( cols, rows ) )
+  {
+    for ( pass = 0; pass < passes; pass++ )
+      for ( row = 0; row < rows; row++ )
+        attrUsec += timeAttr( attr, row );
+    attrUsec /= 2;
+  }
 
-  return true;
-}
-//-----------------------------------------------------------------------------
-void PspMdMouse::SetPos(int x_, int y_)
-{
-  if ( x_ < m_regionLeft )
-    m_x = m_regionLeft;
-  else if ( x_ > m_regionRight )
-    m_x = m_regionRight;
-  else
-    m_x = x_;
+  for ( pass = 0; pass < passes; pass++ )
+  {
+    (void)gettimeofday( &start, NULL );
+    for ( row = 0; row < rows; row++ )
+      for ( col = 0; col < cols; col++ )
+        (void)tint( col, row, true );
+    blendUsec += elapsedUsec( start );
+
+    (void)gettimeofday( &start, NULL );
+    for ( row = 0; row < rows; row++ )
+      for ( col = 0; col < cols; col++ )
+        (void)tint( col, row, false );
+    restoreUsec += elapsedUsec( start );
+  }
 
-  if ( y_ < m_regionTop )
-    m_y = m_regionTop;
-  else if ( y_ > m_regionBottom )
-    m_y = m_regionBottom;
-  else
-    m_y = y_;
-}
+  // The search runs over the text on screen, the way a console change
+  // makes it run
+  PspMdSearch search;
+  if ( search.Resize( cols, rows ) &&
+       search.SetPattern( c_benchPattern, sizeof( c_benchPattern ) - 1 ) &&
+       m_snapshot.Capture( m_console ) )
+  {
+    (void)gettimeofday( &start, NULL );
+    for ( pass = 0; pass < passes; pass++ )
+      (void)search.Find( m_snapshot.GetText(), 0, -1 );
+    searchUsec = elapsedUsec( start );
+  }
 
+  // A full screen copied from the bytes and from the code points
+  (void)gettimeofday( &start, NULL );
+  for ( pass = 0; pass < passes; pass++ )
+    (void)copyRows( 0, m_consoleSize - 1, false, false );
+  copyUsec = elapsedUsec( start );
 
-//-----------------------------------------------------------------------------
-// Class: PspMouseDaemon
-//-----------------------------------------------------------------------------
-PspMouseDaemon::PspMouseDaemon()
-  : m_console( *this ),
-    m_screen( *this ),
-    m_mouse( *this ),
-    m_colWidth( 1 ),
-    m_rowHeight( 1 ),
-    m_col( 0 ),
-    m_row( 0 ),
-    m_clipboardBuf( NULL ),
-    m_clipboardSize( 0 ),
-    m_currentState( NULL ),
-    m_failedState( *this ),
-    m_cursorState( *this ),
-    m_highlightState( *this )
-{
+  if ( m_console.HasCodes() )
+  {
+    (void)gettimeofday( &start, NULL );
+    for ( pass = 0; pass < passes; pass++ )
+      (void)copyRows( 0, m_consoleSize - 1, false, true );
+    codesUsec = elapsedUsec( start );
+  }
+
+  (void)clearCb();
+
+  // The acceleration curve costs the same for a crawl and a flick
+  const PspMdAccel & accel = m_mouse.GetAccel();
+  volatile int sink = 0;
+  int carry = 0;
+  int i;
+
+  (void)gettimeofday( &start, NULL );
+  for ( pass = 0; pass < passes; pass++ )
+    for ( i = 0; i < c_benchPackets; i++ )
+      sink += accel.Apply( ( i & 1 ) ? c_benchSlowDelta : -c_benchSlowDelta,
+                           carry );
+  slowUsec = elapsedUsec( start );
+
+  (void)gettimeofday( &start, NULL );
+  for ( pass = 0; pass < passes; pass++ )
+    for ( i = 0; i < c_benchPackets; i++ )
+      sink += accel.Apply( ( i & 1 ) ? c_benchFastDelta : -c_benchFastDelta,
+                           carry );
+  fastUsec = elapsedUsec( start );
+
+  showOverlay();
+  (void)sync();
+
+  printf( "%d passes over %dx%d pixels, usec per pass:\n"
+          "  xor      %u\n"
+          "  attr     %u\n"
+          "  blend    %u\n"
+          "  restore  %u\n"
+          "  search   %u\n"
+          "  copy     %u bytes, %u code points\n"
+          "  accel    %u slow, %u fast (%d packets)\n",
+          passes, m_screen.GetWidth(), m_screen.GetHeight(),
+          xorUsec / passes, attrUsec / passes,
+          blendUsec / passes, restoreUsec / passes,
+          searchUsec / passes, copyUsec / passes, codesUsec / passes,
+          slowUsec / passes, fastUsec / passes,
+          c_benchPackets );
+
+  return true;
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::~PspMouseDaemon()
+bool PspMouseDaemon::chooseRenderer()
 {
-  if ( m_clipboardBuf != NULL )
+  if ( !pickRenderer() )
+    return false;
+
+  // What is left to the XOR renderer needs the marker bits of a 32bpp
+  // pixel. Below that the arrow has to replace the cursor and the tint the
+  // highlight, or the driver has to draw them through the attributes.
+  if ( !m_attr.IsEnabled() &&
+       m_screen.GetBytesPerPixel() != sizeof( unsigned int ) &&
+       !( m_options.pointer && m_blend.IsEnabled() ) )
   {
-    delete[] m_clipboardBuf;
-    m_clipboardBuf = NULL;
-    m_clipboardSize = 0;
+    m_recorder.Record( EVT_RENDERER, PspMdOptions::RENDERER_XOR,
+                       m_screen.GetBytesPerPixel() );
+    DBG(( DBG_PREFIX "The XOR renderer needs a 32bpp framebuffer, "
+                     "use -p with -a or the attr renderer\n" ));
+    return false;
   }
+
+  return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::Initialize()
+bool PspMouseDaemon::pickRenderer()
 {
-  if ( !m_console.Initialize() ||
-       !m_screen.Initialize() ||
-       !m_mouse.Initialize() ||
-       !m_mouse.SetRegion( 0, 0,
-                           m_screen.GetWidth() - 1,
-                           m_screen.GetHeight() - 1 )
-    )
+  // Page flipping composes pixels the driver does not draw into
+  if ( m_options.renderer == PspMdOptions::RENDERER_XOR ||
+       ( m_options.renderer == PspMdOptions::RENDERER_AUTO &&
+         m_screen.IsDoubleBuffered() ) )
   {
-    return false;
+    return true;
   }
 
-  m_colWidth = m_screen.GetWidth() / m_console.GetCols();
-  m_rowHeight = m_screen.GetHeight() / m_console.GetRows();
-  screenToConsole( m_mouse.GetX(), m_mouse.GetY(), m_col, m_row );
+  if ( !m_attr.Initialize( c_vcsaDevName ) ||
+       !m_attr.Build( m_console.GetCols(), m_console.GetRows() ) )
+  {
+    m_attr.Close();
+    return m_options.renderer == PspMdOptions::RENDERER_AUTO;
+  }
 
-  m_clipboardSize = m_console.GetCols() * m_console.GetRows();
-  m_clipboardBuf = new char[ m_clipboardSize + 1 ];
-  if ( m_clipboardBuf == NULL )
+  if ( m_options.renderer == PspMdOptions::RENDERER_ATTR ||
+       m_screen.GetBytesPerPixel() != sizeof( unsigned int ) )
   {
-    DBG(( DBG_PREFIX "Failed to allocate memory for clipboard, size=%d\n",
-          m_clipboardSize + 1 ));
-    return false;
+    m_recorder.Record( EVT_RENDERER, PspMdOptions::RENDERER_ATTR );
+    return true;
   }
 
-  // Set the safety net
-  m_clipboardBuf[ m_clipboardSize ] = 0;
+  // Pixel work grows with the font, the attribute writes and the glyph
+  // redraw depend on the driver, so both are timed on a row of this mode.
+  // Each draws and clears, the screen is left as it was. A restart on the
+  // same layout takes the previous result.
+  PspMdOptions::Renderer renderer =
+    (PspMdOptions::Renderer)m_persist.GetRenderer();
+  unsigned int xorUsec = 0;
+  unsigned int attrUsec = 0;
+  if ( renderer == PspMdOptions::RENDERER_AUTO )
+  {
+    xorUsec = timeXor( 0 );
+    attrUsec = timeAttr( m_attr, 0 );
+    renderer = ( attrUsec < xorUsec ) ? PspMdOptions::RENDERER_ATTR
+                                      : PspMdOptions::RENDERER_XOR;
+    m_persist.SetRenderer( renderer );
+  }
 
-  // Start from Cursor state
-  changeState( &m_cursorState );
+  m_recorder.Record( EVT_RENDERER, renderer, xorUsec, attrUsec );
+  if ( renderer == PspMdOptions::RENDERER_XOR )
+    m_attr.Close();
 
   return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::Run()
+unsigned int PspMouseDaemon::timeXor(int row_)
 {
-  while ( !m_currentState->isFailed() )
+  struct timeval start;
+  (void)gettimeofday( &start, NULL );
+
+  for ( int pass = 0; pass < 2; pass++ )
   {
-    if ( !m_mouse.Poll() )
+    for ( int col = 0; col < m_geometry.GetCols(); col++ )
     {
-      sleep( c_failureDelay );
-      continue;
+      (void)m_screen.Xor( m_geometry.GetCell( col, row_ ),
+                          m_geometry.GetCellWidth( col ),
+                          m_geometry.GetCellHeight( row_ ),
+                          c_highlightColor );
     }
-
-    changeState(
-        m_currentState->processMouse( m_mouse.GetLeft(),
-                                      m_mouse.GetMid(),
-                                      m_mouse.GetRight(),
-                                      m_mouse.GetX(),
-                                      m_mouse.GetY() )
-      );
   }
 
-  DBG(( DBG_PREFIX "Mouse daemon terminates\n" ));
-  return true;
+  return elapsedUsec( start );
+}
+//-----------------------------------------------------------------------------
+unsigned int PspMouseDaemon::timeAttr(PspMdAttr & attr_, int row_)
+{
+  const int first = row_ * m_geometry.GetCols();
+  const int last = first + m_geometry.GetCols();
+  struct timeval start;
+  int cell;
+
+  (void)gettimeofday( &start, NULL );
+
+  for ( cell = first; cell < last; cell++ )
+    (void)attr_.Mark( cell, PspMdAttr::MARK_HIGHLIGHT );
+  (void)attr_.Flush();
+
+  for ( cell = first; cell < last; cell++ )
+    (void)attr_.Unmark( cell, PspMdAttr::MARK_HIGHLIGHT );
+  (void)attr_.Flush();
+
+  return elapsedUsec( start );
 }
 //-----------------------------------------------------------------------------
-void PspMouseDaemon::changeState(BaseState * newState_)
+bool PspMouseDaemon::enterLowLatency()
 {
-  while ( m_currentState != newState_ )
+  struct sched_param param;
+  int minPriority = sched_get_priority_min( SCHED_FIFO );
+  int maxPriority = sched_get_priority_max( SCHED_FIFO );
+
+  param.sched_priority = m_options.rtPriority;
+  if ( param.sched_priority < minPriority )
+    param.sched_priority = minPriority;
+  else if ( param.sched_priority > maxPriority )
+    param.sched_priority = maxPriority;
+
+  if ( sched_setscheduler( 0, SCHED_FIFO, &param ) < 0 )
+  {
+    m_recorder.Record( EVT_SCHED_FAIL, errno, param.sched_priority );
+    DBG(( DBG_PREFIX "Failed to set real-time priority %d\n",
+          param.sched_priority ));
+    return false;
+  }
+
+  // Grow the stack to its working size up front so that deep draw paths
+  // never take a fault, then pin everything including future mappings
+  char stack[ c_stackPrefaultSize ];
+  volatile char * page = stack;
+  for ( int i = 0; i < c_stackPrefaultSize; i += c_pageSize )
+    page[ i ] = 0;
+
+  if ( mlockall( MCL_CURRENT | MCL_FUTURE ) < 0 )
   {
-    if ( m_currentState )
-      m_currentState->exitState();
-    m_currentState = newState_;
-    newState_ = m_currentState->enterState();
+    m_recorder.Record( EVT_MLOCK_FAIL, errno );
+    DBG(( DBG_PREFIX "Failed to lock the daemon memory\n" ));
+    return false;
   }
+
+  return true;
 }
 //-----------------------------------------------------------------------------
 void PspMouseDaemon::screenToConsole(int x_, int y_, int & col_, int & row_)
 {
-  col_ = x_ / m_colWidth;
-  row_ = y_ / m_rowHeight;
+  m_geometry.ScreenToCell( x_, y_, col_, row_ );
 }
 //-----------------------------------------------------------------------------
 void PspMouseDaemon::consoleToLinear(int col_, int row_, int & pos_)
@@ -518,16 +2620,16 @@ void PspMouseDaemon::consoleToLinear(int col_, int row_, int & pos_)
   pos_ = row_ * cols + col_;
   if ( pos_ < 0 )
     pos_ = 0;
-  else if ( pos_ >= m_clipboardSize )
-    pos_ = m_clipboardSize - 1;
+  else if ( pos_ >= m_consoleSize )
+    pos_ = m_consoleSize - 1;
 }
 //-----------------------------------------------------------------------------
 void PspMouseDaemon::linearToConsole(int pos_, int & col_, int & row_)
 {
   if ( pos_ < 0 )
     pos_ = 0;
-  else if ( pos_ >= m_clipboardSize )
-    pos_ = m_clipboardSize - 1;
+  else if ( pos_ >= m_consoleSize )
+    pos_ = m_consoleSize - 1;
 
   col_ = pos_ % m_console.GetCols();
   row_ = pos_ / m_console.GetCols();
@@ -541,11 +2643,37 @@ bool PspMouseDaemon::draw
   bool highlight_
 )
 {
-  int x = col_ * m_colWidth;
-  int y = row_ * m_rowHeight;
-  unsigned int * start = m_screen.GetAddress() +
-                         x +
-                         y * m_screen.GetVirtualWidth();
+  if ( m_pointer.IsEnabled() )
+  {
+    // The arrow replaces the cell cursor and must be off the cells first
+    if ( !highlight_ )
+      return true;
+
+    cursor_ = false;
+    m_pointer.Hide();
+  }
+
+  if ( highlight_ && m_blend.IsEnabled() )
+  {
+    // The tint goes under the cursor
+    return tint( col_, row_, true ) &&
+           ( !cursor_ || draw( col_, row_, true, false ) );
+  }
+
+  if ( m_attr.IsEnabled() )
+  {
+    // Written out for the whole batch in sync()
+    if ( m_attr.Mark( row_ * m_geometry.GetCols() + col_,
+                      ( cursor_ ? PspMdAttr::MARK_CURSOR : 0 ) |
+                      ( highlight_ ? PspMdAttr::MARK_HIGHLIGHT : 0 ) ) )
+    {
+      m_stats.Add( PspMdStats::CELLS_DRAWN );
+      m_dirty = true;
+    }
+    return true;
+  }
+
+  unsigned int * start = m_geometry.GetCell( col_, row_ );
 
   unsigned int code;
   if ( cursor_ && highlight_ )
@@ -598,7 +2726,17 @@ bool PspMouseDaemon::draw
   }
 
   if ( code != 0 )
-    return m_screen.Xor( x, y, m_colWidth, m_rowHeight, code );
+  {
+    m_stats.Add( PspMdStats::CELLS_DRAWN );
+    m_dirty = true;
+    m_persist.Mark( row_ * m_geometry.GetCols() + col_ );
+    m_screen.Damage( m_geometry.GetCellY( row_ ),
+                     m_geometry.GetCellHeight( row_ ) );
+    return m_screen.Xor( start,
+                         m_geometry.GetCellWidth( col_ ),
+                         m_geometry.GetCellHeight( row_ ),
+                         code );
+  }
 
   return true;
 }
@@ -611,11 +2749,36 @@ bool PspMouseDaemon::clear
   bool highlight_
 )
 {
-  int x = col_ * m_colWidth;
-  int y = row_ * m_rowHeight;
-  unsigned int * start = m_screen.GetAddress() +
-                         x +
-                         y * m_screen.GetVirtualWidth();
+  if ( m_pointer.IsEnabled() )
+  {
+    // The arrow replaces the cell cursor and must be off the cells first
+    if ( !highlight_ )
+      return true;
+
+    cursor_ = false;
+    m_pointer.Hide();
+  }
+
+  if ( highlight_ && m_blend.IsEnabled() )
+  {
+    // Restoring the tint would bring back the pixels under the cursor
+    return ( !cursor_ || clear( col_, row_, true, false ) ) &&
+           tint( col_, row_, false );
+  }
+
+  if ( m_attr.IsEnabled() )
+  {
+    if ( m_attr.Unmark( row_ * m_geometry.GetCols() + col_,
+                        ( cursor_ ? PspMdAttr::MARK_CURSOR : 0 ) |
+                        ( highlight_ ? PspMdAttr::MARK_HIGHLIGHT : 0 ) ) )
+    {
+      m_stats.Add( PspMdStats::CELLS_CLEARED );
+      m_dirty = true;
+    }
+    return true;
+  }
+
+  unsigned int * start = m_geometry.GetCell( col_, row_ );
 
   unsigned int code;
   if ( cursor_ && highlight_ )
@@ -668,24 +2831,88 @@ bool PspMouseDaemon::clear
   }
 
   if ( code != 0 )
-    return m_screen.Xor( x, y, m_colWidth, m_rowHeight, code );
+  {
+    m_stats.Add( PspMdStats::CELLS_CLEARED );
+    m_dirty = true;
+    m_screen.Damage( m_geometry.GetCellY( row_ ),
+                     m_geometry.GetCellHeight( row_ ) );
+    if ( !m_screen.Xor( start,
+                        m_geometry.GetCellWidth( col_ ),
+                        m_geometry.GetCellHeight( row_ ),
+                        code ) )
+    {
+      return false;
+    }
+
+    if ( ( *start & ( c_cursorMask | c_highlightMask ) ) == 0 )
+      m_persist.Unmark( row_ * m_geometry.GetCols() + col_ );
+  }
 
   return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::sync()
+bool PspMouseDaemon::tint(int col_, int row_, bool apply_)
 {
-  return m_screen.Sync();
+  unsigned char * start = (unsigned char *)m_geometry.GetCell( col_, row_ );
+  const int cell = row_ * m_geometry.GetCols() + col_;
+  const int x = m_geometry.GetCellX( col_ );
+  const int y = m_geometry.GetCellY( row_ );
+  const int width = m_geometry.GetCellWidth( col_ );
+  const int height = m_geometry.GetCellHeight( row_ );
+
+  if ( apply_ )
+  {
+    if ( !m_blend.Apply( cell, start, m_geometry.GetLineLength(),
+                         x, y, width, height ) )
+    {
+      return true;
+    }
+
+    m_stats.Add( PspMdStats::CELLS_DRAWN );
+    m_stats.Add( PspMdStats::PIXELS_BLENDED, width * height );
+  }
+  else
+  {
+    if ( !m_blend.Restore( cell, start, m_geometry.GetLineLength(),
+                           x, y, width, height ) )
+    {
+      return true;
+    }
+
+    m_stats.Add( PspMdStats::CELLS_CLEARED );
+  }
+
+  m_dirty = true;
+  m_screen.Damage( y, height );
+  return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::copyCb(int begin_, int end_)
+bool PspMouseDaemon::sync()
 {
-  if ( m_clipboardBuf == NULL )
+  // The driver redraws the glyphs of the swapped cells, which must not be
+  // under the arrow's saved background
+  bool ok = true;
+  if ( m_attr.IsPending() )
   {
-    DBG(( DBG_PREFIX "Invalid clipboard for copy\n" ));
-    return false;
+    m_pointer.Hide();
+    ok = m_attr.Flush();
   }
 
+  if ( m_pointer.IsEnabled() && !m_idle )
+    m_pointer.Show( m_mouse.GetX(), m_mouse.GetY() );
+
+  ok = m_screen.Sync() && ok;
+  m_dirty = false;
+
+  // A page flip swaps the page the cells are drawn on
+  if ( m_geometry.GetBase() != m_screen.GetDrawAddress() )
+    m_geometry.Flip();
+
+  return ok;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::copyCb(int begin_, int end_)
+{
   if ( begin_ > end_ )
   {
     int temp = begin_;
@@ -696,51 +2923,104 @@ bool PspMouseDaemon::copyCb(int begin_, int end_)
   if ( begin_ < 0 )
     begin_ = 0;
 
-  if ( end_ >= m_clipboardSize )
-    end_ = m_clipboardSize - 1;
+  if ( end_ >= m_consoleSize )
+    end_ = m_consoleSize - 1;
+
+  return copyRows( begin_, end_, false, m_console.HasCodes() );
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::copyBlockCb(int from_, int to_)
+{
+  return copyRows( from_, to_, true, m_console.HasCodes() );
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::copyRows(int from_, int to_, bool block_, bool codes_)
+{
+  const int cols = m_console.GetCols();
+  const int first = from_ / cols;
+  const int last = to_ / cols;
 
-  const unsigned int size = (unsigned int)( end_ - begin_ + 1 );
-  unsigned int bytesRead = 0;
+  m_clipboard.Clear();
 
-  if ( !m_console.Seek( (unsigned int)begin_ ) ||
-       !m_console.Read( m_clipboardBuf, size, bytesRead ) )
+  // The code points of the whole span come in one read and are encoded
+  // row by row. Without them every row is read as bytes.
+  if ( codes_ )
   {
-    return false;
+    const unsigned int count = (unsigned int)( to_ - from_ + 1 );
+    unsigned int codesRead = 0;
+    codes_ = m_codes != NULL &&
+             m_console.ReadCodes( (unsigned int)from_, m_codes, count,
+                                  codesRead ) &&
+             codesRead == count;
   }
 
-  if ( bytesRead != size )
+  // One line per row with the trailing blanks dropped
+  for ( int row = first; row <= last; row++ )
   {
-    DBG(( DBG_PREFIX "Only %d out of %d bytes are copied\n", bytesRead, size ));
+    const int begin = ( block_ || row == first ) ? from_ % cols : 0;
+    const int end = ( block_ || row == last ) ? to_ % cols : cols - 1;
+    const int width = end - begin + 1;
+    const int room = codes_ ? width * PspMdUtf8::MAX_BYTES : width;
+
+    char * text = m_clipboard.Extend( room );
+    if ( text == NULL )
+    {
+      m_recorder.Record( EVT_ALLOC_FAIL, room );
+      break;
+    }
+
+    int len;
+    if ( codes_ )
+    {
+      len = PspMdUtf8::EncodeRow( m_codes + row * cols + begin - from_,
+                                  width,
+                                  text );
+    }
+    else
+    {
+      unsigned int bytesRead = 0;
+      if ( !m_console.Seek( (unsigned int)( row * cols + begin ) ) ||
+           !m_console.Read( text, width, bytesRead ) )
+      {
+        m_clipboard.Shrink( room );
+        break;
+      }
+
+      len = (int)bytesRead;
+      while ( len > 0 && text[ len - 1 ] == ' ' )
+        len--;
+    }
+
+    m_clipboard.Shrink( room - len );
+
+    if ( row < last && !m_clipboard.Append( "\n", 1 ) )
+      break;
   }
 
-  m_clipboardBuf[ bytesRead ] = 0;
+  m_recorder.Record( EVT_COPY, from_, to_, m_clipboard.GetSize() );
+  m_stats.Add( PspMdStats::COPY_BYTES, m_clipboard.GetSize() );
   return true;
 }
 //-----------------------------------------------------------------------------
 bool PspMouseDaemon::pasteCb()
 {
-  if ( m_clipboardBuf == NULL )
+  for ( const PspMdClipboard::Chunk * chunk = m_clipboard.GetFirst();
+        chunk != NULL;
+        chunk = chunk->next )
   {
-    DBG(( DBG_PREFIX "Invalid clipboard for paste\n" ));
-    return false;
+    if ( !m_console.Paste( chunk->data, chunk->size ) )
+      return false;
   }
 
-  return m_console.Paste( m_clipboardBuf );
+  return true;
 }
 //-----------------------------------------------------------------------------
 bool PspMouseDaemon::clearCb()
 {
-  if ( m_clipboardBuf == NULL )
-  {
-    DBG(( DBG_PREFIX "Invalid clipboard for clear\n" ));
-    return false;
-  }
-
-  m_clipboardBuf[ 0 ] = 0;
+  m_clipboard.Clear();
   return true;
 }
 
-
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
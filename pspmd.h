@@ -3,12 +3,31 @@
  * Created by Jackson Mo, Jan 29, 2008
  *---------------------------------------------------------------------------*/
 #include <stdio.h>
+#include <sys/time.h>
+#include "pspmdstats.h"
+#include "pspmdarena.h"
+#include "pspmdrecorder.h"
+#include "pspmdgeometry.h"
+#include "pspmdpointer.h"
+#include "pspmdblend.h"
+#include "pspmdsnapshot.h"
+#include "pspmdclipboard.h"
+#include "pspmdsearch.h"
+#include "pspmdring.h"
+#include "pspmdcontrol.h"
+#include "pspmdaccel.h"
+#include "pspmdattr.h"
+#include "pspmdutf8.h"
+#include "pspmdpersist.h"
+#include "pspmdhandoff.h"
 
 
 //-----------------------------------------------------------------------------
 // Macros
 //-----------------------------------------------------------------------------
-#if 1
+// Console printf debugging, off by default since every message scrolls the
+// very framebuffer the daemon draws on. Use the flight recorder instead.
+#if 0
 #define DEBUG       1
 #endif
 
@@ -28,30 +47,122 @@ class PspMdConsole;
 class PspMdScreen;
 class PspMdMouse;
 class PspMouseDaemon;
+struct fb_var_screeninfo;
+
+
+//-----------------------------------------------------------------------------
+// Struct: PspMdOptions
+//-----------------------------------------------------------------------------
+struct PspMdOptions
+{
+  enum
+  {
+    MAX_MICE      = 4           // Input devices merged into the pointer
+  };
+
+  enum Renderer
+  {
+    RENDERER_AUTO = 0,          // The cheaper of the two on this mode
+    RENDERER_XOR,               // Pixels in the framebuffer
+    RENDERER_ATTR               // Attribute bytes through /dev/vcsa
+  };
+
+  PspMdOptions();
+
+  bool lowLatency;      // SCHED_FIFO, locked memory and prefaulted VRAM
+  int  rtPriority;      // SCHED_FIFO priority used in low latency mode
+  bool doubleBuffer;    // Compose in the back page and flip
+  bool pointer;         // Arrow sprite instead of the cell cursor
+  int  alpha;           // Blended highlight opacity, 0 = XOR highlight
+  int  benchPasses;     // Benchmark the renderers instead of running
+  bool matches;         // Highlight the other occurrences of a selection
+  bool service;         // Serve mouse events to console applications
+  bool control;         // Accept synthetic input on the control socket
+  const char * mice[ MAX_MICE ];  // Input devices, /dev/mouse if none
+  int  mouseCount;
+  int  accelSpeed;      // Pointer speed in percent of the counts
+  int  accelFactor;     // Percent applied beyond the threshold
+  int  accelThreshold;  // Counts per packet moved at the plain speed
+  Renderer renderer;    // Cursor and highlight renderer
+  int  idleSec;         // Hide the cursor after this long without input,
+                        // 0 = never
+  int  arenaKb;         // Carve every buffer from one region of this many
+                        // KB, 0 = sized from the console, -1 = heap
+  bool footprint;       // Print the memory footprint at startup
+  bool persist;         // Keep the state in shared memory across restarts
+  bool handoff;         // Take the devices over from a running instance and
+                        // hand them to the next one
+  int  fontWidth;       // Console cell size in pixels, 0 = detect
+  int  fontHeight;
+};
+
+
+//-----------------------------------------------------------------------------
+// Struct: PspMdEvent
+//
+// One decoded mouse event: the button state and the absolute pointer
+// position after the packet.
+//-----------------------------------------------------------------------------
+struct PspMdEvent
+{
+  unsigned int buttons;     // PspMdMouse::BUTTON_* bits
+  int x;
+  int y;
+};
 
 
 //-----------------------------------------------------------------------------
 // Class: PspMdConsole
+//
+// The device classes below have a single implementation each and are not
+// meant to be derived from, so they carry no virtual functions and their
+// hot paths are inlined into the daemon.
 //-----------------------------------------------------------------------------
 class PspMdConsole
 {
 public:
+  enum
+  {
+    REPORT_RELEASE  = 3         // Button code of a release in mouse reports
+  };
+
   PspMdConsole(PspMouseDaemon & md_);
-  virtual ~PspMdConsole();
+  ~PspMdConsole();
 
-  bool Initialize();
+  bool Initialize(int vcsFd_, int vcsuFd_);
+  bool Refresh(int & cols_, int & rows_, bool & resized_);
+  void Resize(int cols_, int rows_)   { m_cols = cols_; m_rows = rows_; }
+  bool GetFontSize(int & width_, int & height_);
   bool Seek(unsigned int pos_);
   bool Read(void * buf_, unsigned int size_, unsigned int & bytesRead_);
-  bool Paste(const char * str_);
+  bool ReadCodes(unsigned int pos_,
+                 unsigned int * codes_,
+                 unsigned int count_,
+                 unsigned int & codesRead_);
+  bool Paste(const char * text_, int size_);
+  bool Scroll(int lines_);
+  bool GetMouseReporting(bool & enabled_);
+  bool ReportMouse(int button_, int col_, int row_);
 
   int GetCols() const { return m_cols; }
   int GetRows() const { return m_rows; }
+  int GetFd() const   { return m_vcsFd; }
+  int GetCodesFd() const  { return m_vcsuFd; }
+  bool HasCodes() const { return m_vcsuFd >= 0; }
 
 protected:
+  bool readSize(int & cols_, int & rows_);
+  bool openTty();
+
   PspMouseDaemon & m_md;
   int m_vcsFd;
+  int m_vcsuFd;                 // Code points, where the kernel has them
+  int m_ttyFd;                  // Opened on first use
   int m_cols;
   int m_rows;
+  bool m_reporting;             // Last mouse reporting mode read
+  bool m_reportingKnown;
+  unsigned int m_reportingMsec; // When it was read
 
 private:
   // Not implemented
@@ -68,28 +179,77 @@ class PspMdScreen
 {
 public:
   PspMdScreen(PspMouseDaemon & md_);
-  virtual ~PspMdScreen();
+  ~PspMdScreen();
 
-  bool Initialize();
+  bool Initialize(int fbFd_, bool prefault_, bool doubleBuffer_);
+  bool Refresh(bool & remapped_, bool & resized_);
   bool Sync();
-  bool Xor(int x_, int y_, int width_, int height_, unsigned int code_);
-
+  void CopyFront(int y_, int height_);
+  bool Xor(unsigned int * start_, int width_, int height_, unsigned int code_);
+  static void XorRect(unsigned int * start_,
+                      int width_,
+                      int height_,
+                      int lineLength_,
+                      unsigned int code_);
+
+  void Damage(int y_, int height_)
+  {
+    if ( y_ < m_damageTop )
+      m_damageTop = y_;
+    if ( y_ + height_ > m_damageBottom )
+      m_damageBottom = y_ + height_;
+  }
+
+  int GetFd() const                 { return m_fbFd; }
   unsigned int * GetAddress() const { return m_vramBase; }
+  unsigned int * GetDrawAddress() const
+  {
+    return ( m_backBase != NULL ) ? m_backBase : m_vramBase;
+  }
+  bool IsDoubleBuffered() const { return m_backBase != NULL; }
+  unsigned int MakePixel(unsigned int rgb_) const;
   unsigned int GetSize() const  { return m_vramSize; }
   int GetWidth() const          { return m_width; }
   int GetHeight() const         { return m_height; }
   int GetVirtualWidth() const   { return m_virtualWidth; }
   int GetVirtualHeight() const  { return m_virtualHeight; }
+  int GetLineLength() const     { return m_lineLength; }
+  int GetBytesPerPixel() const  { return m_bytesPerPixel; }
 
 protected:
+  bool readMode(struct fb_var_screeninfo & vinfo_);
+  bool map(int xOffset_, int yOffset_);
+  void unmap();
+  bool present();
+  void copyRows(unsigned int * to_, const unsigned int * from_,
+                int top_, int bottom_);
+
   PspMouseDaemon & m_md;
   int m_fbFd;
-  unsigned int * m_vramBase;
-  unsigned int m_vramSize;
+  void * m_mapBase;             // Page aligned start of the mapping
+  unsigned int * m_vramBase;    // First visible pixel
+  unsigned int m_vramSize;      // Size of the mapping
   int m_width;
   int m_height;
   int m_virtualWidth;
   int m_virtualHeight;
+  int m_lineLength;
+  int m_bytesPerPixel;
+  int m_xOffset;
+  int m_yOffset;
+  int m_redOffset;
+  int m_redLength;
+  int m_greenOffset;
+  int m_greenLength;
+  int m_blueOffset;
+  int m_blueLength;
+  bool m_prefault;
+  bool m_doubleBuffer;
+  bool m_vsync;
+  unsigned int * m_backBase;    // First pixel of the back page, if any
+  int m_backYOffset;
+  int m_damageTop;              // Rows of the back page drawn since the
+  int m_damageBottom;           // last flip, bottom exclusive
 
 private:
   // Not implemented
@@ -101,16 +261,38 @@ private:
 
 //-----------------------------------------------------------------------------
 // Class: PspMdMouse
+//
+// One pointer driven by every input device. Poll() reads every packet
+// queued in the devices that are ready and decodes them into events. Each
+// device keeps its own partial packet and buttons; the buttons of an event
+// are those of all devices together, and the motion of all of them moves
+// the same pointer. Consecutive packets with the same buttons only move
+// the pointer, so they are folded into one event at the last position.
 //-----------------------------------------------------------------------------
 class PspMdMouse
 {
 public:
-  PspMdMouse(PspMouseDaemon & md_);
-  virtual ~PspMdMouse();
+  enum
+  {
+    BUTTON_LEFT   = 0x1,
+    BUTTON_MID    = 0x2,
+    BUTTON_RIGHT  = 0x4,
+    EVENT_BATCH   = 32,         // Packets read at most per device and poll
+    MAX_DEVICES   = PspMdOptions::MAX_MICE
+  };
 
-  bool Initialize();
+  PspMdMouse(PspMouseDaemon & md_);
+  ~PspMdMouse();
+
+  bool Initialize(const char * const * devNames_,
+                  int count_,
+                  const int * fds_,
+                  int fdCount_);
+  void SaveDevices(PspMdHandoffState & state_) const;
+  void RestoreDevices(const PspMdHandoffState & state_);
+  bool SetAcceleration(int speed_, int accel_, int threshold_);
   bool SetRegion(int left_, int top_, int right_, int bottom_);
-  bool Poll();
+  bool Poll(unsigned int ready_);
   void SetPos(int x_, int y_);
 
   bool GetLeft() const  { return m_left; }
@@ -119,9 +301,32 @@ public:
   int GetX() const      { return m_x; }
   int GetY() const      { return m_y; }
 
+  int GetDeviceCount() const            { return m_deviceCount; }
+  int GetFd(int index_) const           { return m_devices[ index_ ].fd; }
+  const PspMdEvent * GetEvents() const  { return m_events; }
+  int GetEventCount() const             { return m_eventCount; }
+  const PspMdAccel & GetAccel() const   { return m_accel; }
+
 protected:
+  struct Device
+  {
+    int fd;                     // Closed once the device is gone
+    char partial[ 3 ];          // Bytes of a packet split across reads
+    int partialSize;
+    unsigned int buttons;       // BUTTON_* bits of the last packet
+    int carryX;                 // Fraction of a pixel not moved yet
+    int carryY;
+  };
+
+  bool pollDevice(int index_, int & packets_);
+  void addEvent();
+
   PspMouseDaemon & m_md;
-  int m_mouseFd;
+  Device m_devices[ MAX_DEVICES ];
+  int m_deviceCount;
+  PspMdEvent m_events[ EVENT_BATCH * MAX_DEVICES ];
+  int m_eventCount;
+  PspMdAccel m_accel;
   bool m_left;
   bool m_mid;
   bool m_right;
@@ -147,49 +352,131 @@ class PspMouseDaemon
 {
 public:
   PspMouseDaemon();
-  virtual ~PspMouseDaemon();
+  ~PspMouseDaemon();
 
-  bool Initialize();
+  bool Initialize(const PspMdOptions & options_);
   bool Run();
+  bool Benchmark();
+
+  PspMdStats & GetStats()       { return m_stats; }
+  PspMdRecorder & GetRecorder() { return m_recorder; }
 
 protected:
   // Internal states
-  class BaseState;
-    class FailedState;
-    class CursorState;
-    class HighlightState;
-
   #define PSPMD_STATES_H
   #include "pspmdstates.h"
   #undef  PSPMD_STATES_H
 
-  void changeState(BaseState * newState_);
+  bool enterLowLatency();
+  bool reserveArena();
+  void reportFootprint();
+  void restoreState();
+  bool takeOver();
+  bool completeTakeover();
+  void applyTakeover();
+  void handOff();
+  int eraseStale();
+  void saveState();
+  bool chooseRenderer();
+  bool pickRenderer();
+  unsigned int timeXor(int row_);
+  unsigned int timeAttr(PspMdAttr & attr_, int row_);
+  bool buildGeometry(bool keepPointer_);
+  bool checkGeometry(bool changed_);
+  void syncPages();
+  bool reloadGeometry(bool eraseOverlay_, int cols_, int rows_);
+  bool resizeClipboard();
+  bool waitEvents(unsigned int & input_,
+                  bool & control_,
+                  bool & console_,
+                  bool & handoff_);
+  int idleTimeout() const;
+  void trackIdle(bool input_);
+  void serveControl();
+  int injectMotions(const PspMdCtlMotion * motions_,
+                    int count_,
+                    unsigned int & processed_);
+  bool injectSelect(const PspMdCtlSelect & select_);
+  bool captureConsole();
+  void trackScroll();
+  void trackMatches();
+  void startSearch();
+  void findMatches();
+  void hideMatches();
+  void paintMatches(bool draw_);
+  void hideOverlay();
+  void showOverlay();
+  void serveEvents(const PspMdEvent * events_, int count_);
+  void forwardEvents(const PspMdEvent * events_, int count_, bool report_);
+  void processEvents(const PspMdEvent * events_, int count_);
+  void dispatch(Input input_);
+  Input pressInput();
+  void changeState(State newState_);
+  static bool isSelecting(State state_);
+  void moveCursor();
+  void scroll();
+  void autoScroll();
   void screenToConsole(int x_, int y_, int & col_, int & row_);
   void consoleToLinear(int col_, int row_, int & pos_);
   void linearToConsole(int pos_, int & col_, int & row_);
 
   bool draw(int col_, int row_, bool cursor_, bool highlight_);
   bool clear(int col_, int row_, bool cursor_, bool highlight_);
+  bool tint(int col_, int row_, bool apply_);
   bool sync();
   bool copyCb(int begin_, int end_);
+  bool copyBlockCb(int from_, int to_);
+  bool copyRows(int from_, int to_, bool block_, bool codes_);
   bool pasteCb();
   bool clearCb();
 
+  PspMdArena      m_arena;              // Goes first, everything below
+                                        // returns its buffers to it
+  PspMdHandoff    m_handoff;            // Closes after the devices, the
+                                        // next instance waits for it
+  PspMdOptions    m_options;
+  PspMdStats      m_stats;
+  PspMdRecorder   m_recorder;
   PspMdConsole    m_console;
   PspMdScreen     m_screen;
   PspMdMouse      m_mouse;
-
-  int             m_colWidth;
-  int             m_rowHeight;
+  PspMdPointer    m_pointer;
+
+  PspMdGeometry   m_geometry;
+  PspMdBlend      m_blend;
+  PspMdAttr       m_attr;
+  PspMdSnapshot   m_snapshot;
+  PspMdSnapshot   m_pages;              // Console text as last brought over
+                                        // to the back page
+  PspMdSearch     m_search;
+  PspMdRing       m_ring;
+  PspMdControl    m_control;
+  PspMdPersist    m_persist;
   int             m_col;
   int             m_row;
-  char *          m_clipboardBuf;
-  int             m_clipboardSize;
+  PspMdClipboard  m_clipboard;
+  int             m_consoleSize;        // Console cells
+  unsigned int *  m_codes;              // Code points of a copy
+
+  State           m_state;
+  Selection       m_selection;
+  unsigned int    m_buttons;            // Buttons of the last event
+  int             m_eventX;             // Position of the event in dispatch
+  int             m_eventY;
+  unsigned int    m_clickMsec;
+  int             m_clickPos;
+  int             m_clickCount;
+  int             m_scrollY;            // Pointer row of the last scroll step
+  bool            m_dirty;              // Cells changed since the last sync
+  bool            m_idle;               // Cursor hidden for lack of input
+  unsigned int    m_inputMsec;          // Time of the last input
+  unsigned int    m_geometryMsec;       // Time of the last geometry check
+  bool            m_takenOver;          // Started from a running instance
+  bool            m_handedOff;          // Devices gone to the next instance
 
-  BaseState *     m_currentState;
-  FailedState     m_failedState;
-  CursorState     m_cursorState;
-  HighlightState  m_highlightState;
+  static const Transition s_transitions[ STATE_MAX ][ INPUT_MAX ];
+
+  struct timeval  m_launchTime;
 
 
 
@@ -198,13 +485,53 @@ private:
   PspMouseDaemon(const PspMouseDaemon &);
   PspMouseDaemon & operator = (const PspMouseDaemon &);
 
-  friend class BaseState;
-  friend class FailedState;
-  friend class CursorState;
-  friend class HighlightState;
+  friend class Selection;
 };
 
 
+//-----------------------------------------------------------------------------
+// Inline implementations
+//-----------------------------------------------------------------------------
+inline bool PspMdScreen::Xor
+(
+  unsigned int * start_,
+  int width_,
+  int height_,
+  unsigned int code_
+)
+{
+  if ( m_vramBase == NULL )
+  {
+    DBG(( DBG_PREFIX "Tried to draw on an invalid device\n" ));
+    return false;
+  }
+
+  XorRect( start_, width_, height_, m_lineLength, code_ );
+  m_md.GetStats().Add( PspMdStats::PIXELS_XORED, width_ * height_ );
+  return true;
+}
+//-----------------------------------------------------------------------------
+inline void PspMdScreen::XorRect
+(
+  unsigned int * start_,
+  int width_,
+  int height_,
+  int lineLength_,
+  unsigned int code_
+)
+{
+  // Shared with the geometry check, which runs it on the development host
+  unsigned int * p = start_;
+  for ( int i = 0; i < height_; i++ )
+  {
+    for ( int j = 0; j < width_; j++ )
+      p[ j ] ^= code_;
+
+    p = (unsigned int *)( (char *)p + lineLength_ );
+  }
+}
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
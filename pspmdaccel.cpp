@@ -0,0 +1,61 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int c_unityPercent           = 100;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdAccel
+//-----------------------------------------------------------------------------
+PspMdAccel::PspMdAccel()
+{
+  // Counts map to pixels one to one until a curve is built
+  for ( int i = 0; i <= MAX_DELTA; i++ )
+    m_curve[ i ] = i << FRACTION_BITS;
+}
+//-----------------------------------------------------------------------------
+PspMdAccel::~PspMdAccel()
+{
+}
+//-----------------------------------------------------------------------------
+bool PspMdAccel::Build(int speed_, int accel_, int threshold_)
+{
+  if ( speed_ <= 0 || accel_ <= 0 || threshold_ < 0 )
+  {
+    DBG(( DBG_PREFIX "Invalid acceleration curve %d,%d,%d\n",
+          speed_, accel_, threshold_ ));
+    return false;
+  }
+
+  // Percentages are applied to whole fixed point values, the largest
+  // product stays far below 2^31
+  const int slow = ( speed_ << FRACTION_BITS ) / c_unityPercent;
+  const int fast = ( ( speed_ * accel_ ) << FRACTION_BITS ) /
+                   ( c_unityPercent * c_unityPercent );
+
+  for ( int i = 0; i <= MAX_DELTA; i++ )
+  {
+    if ( i <= threshold_ )
+      m_curve[ i ] = i * slow;
+    else
+      m_curve[ i ] = threshold_ * slow + ( i - threshold_ ) * fast;
+  }
+
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
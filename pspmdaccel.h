@@ -0,0 +1,62 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDACCEL_H
+#define PSPMDACCEL_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdAccel
+//
+// Pointer acceleration curve. The motion of a packet is one signed byte
+// per axis, so the curve is tabulated once for every magnitude, in pixels
+// with FRACTION_BITS of fraction. Moving the pointer then costs a lookup
+// and an add whatever the speed, and no floating point is involved. The
+// fraction left over is carried into the next packet by the caller.
+//
+// Up to the threshold a packet moves speed percent of its counts; beyond
+// it every further count moves accel percent of that, so the curve has no
+// step.
+//-----------------------------------------------------------------------------
+class PspMdAccel
+{
+public:
+  enum
+  {
+    FRACTION_BITS = 8,
+    MAX_DELTA     = 128         // Largest magnitude of a packet delta
+  };
+
+  PspMdAccel();
+  ~PspMdAccel();
+
+  bool Build(int speed_, int accel_, int threshold_);
+
+  // Pixels to move for delta_ counts, carry_ keeps the fraction
+  int Apply(int delta_, int & carry_) const
+  {
+    const int move = carry_ + ( ( delta_ < 0 ) ? -m_curve[ -delta_ ]
+                                               :  m_curve[ delta_ ] );
+    const int pixels = move >> FRACTION_BITS;
+    carry_ = move - ( pixels << FRACTION_BITS );
+    return pixels;
+  }
+
+protected:
+  int m_curve[ MAX_DELTA + 1 ];
+
+private:
+  // Not implemented
+  PspMdAccel(const PspMdAccel &);
+  PspMdAccel & operator = (const PspMdAccel &);
+};
+
+
+#endif  // PSPMDACCEL_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,279 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const unsigned int c_align         = 8;
+static const char * const c_tagNames[ PspMdArena::TAG_MAX ] =
+{
+  "other",
+  "geometry",
+  "blend",
+  "attr",
+  "pointer",
+  "snapshot",
+  "search",
+  "selection",
+  "clipboard",
+  "codes"
+};
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+static inline unsigned int alignUp(size_t size_)
+{
+  return ( (unsigned int)size_ + c_align - 1 ) & ~( c_align - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Global allocation operators
+//
+// The daemon is built with -fcheck-new, a failed allocation returns NULL
+// and the callers check for it. The sized deletes a newer compiler may
+// call go to the same place.
+//-----------------------------------------------------------------------------
+void * operator new(size_t size_)
+{
+  return PspMdArena::Allocate( size_ );
+}
+//-----------------------------------------------------------------------------
+void * operator new[](size_t size_)
+{
+  return PspMdArena::Allocate( size_ );
+}
+//-----------------------------------------------------------------------------
+void operator delete(void * p_)
+{
+  PspMdArena::Free( p_ );
+}
+//-----------------------------------------------------------------------------
+void operator delete[](void * p_)
+{
+  PspMdArena::Free( p_ );
+}
+//-----------------------------------------------------------------------------
+void operator delete(void * p_, size_t)
+{
+  PspMdArena::Free( p_ );
+}
+//-----------------------------------------------------------------------------
+void operator delete[](void * p_, size_t)
+{
+  PspMdArena::Free( p_ );
+}
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdArena
+//-----------------------------------------------------------------------------
+PspMdArena *        PspMdArena::s_active = NULL;
+PspMdArena::Tag     PspMdArena::s_tag = PspMdArena::TAG_OTHER;
+unsigned int        PspMdArena::s_heapAllocs = 0;
+unsigned int        PspMdArena::s_bytes[ PspMdArena::TAG_MAX ];
+unsigned int        PspMdArena::s_peak[ PspMdArena::TAG_MAX ];
+unsigned int        PspMdArena::s_blocks[ PspMdArena::TAG_MAX ];
+//-----------------------------------------------------------------------------
+PspMdArena::PspMdArena()
+  : m_base( NULL ),
+    m_size( 0 ),
+    m_used( 0 ),
+    m_peak( 0 ),
+    m_failures( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdArena::~PspMdArena()
+{
+  if ( s_active == this )
+    s_active = NULL;
+
+  free( m_base );
+}
+//-----------------------------------------------------------------------------
+bool PspMdArena::Initialize(int size_)
+{
+  if ( m_base != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdArena has been initialized\n" ));
+    return true;
+  }
+
+  // The region itself is the last block the heap hands out
+  const unsigned int size = alignUp( size_ );
+  if ( size < sizeof( Block ) + c_align )
+  {
+    DBG(( DBG_PREFIX "Invalid arena size %d\n", size_ ));
+    return false;
+  }
+
+  m_base = (char *)malloc( size );
+  if ( m_base == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to reserve an arena of %u bytes\n", size ));
+    return false;
+  }
+
+  s_heapAllocs++;
+  m_size = size;
+
+  Block * block = (Block *)m_base;
+  block->size = size - sizeof( Block );
+  block->tag = TAG_OTHER;
+  block->used = 0;
+
+  s_active = this;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdArena::Report() const
+{
+  printf( "%-12s %10s %10s %7s\n", "subsystem", "bytes", "peak", "blocks" );
+
+  unsigned int bytes = 0, peak = 0, blocks = 0;
+  for ( int i = 0; i < TAG_MAX; i++ )
+  {
+    if ( s_peak[ i ] == 0 )
+      continue;
+
+    printf( "%-12s %10u %10u %7u\n",
+            c_tagNames[ i ], s_bytes[ i ], s_peak[ i ], s_blocks[ i ] );
+    bytes += s_bytes[ i ];
+    peak += s_peak[ i ];
+    blocks += s_blocks[ i ];
+  }
+
+  printf( "%-12s %10u %10u %7u\n", "total", bytes, peak, blocks );
+
+  if ( m_base != NULL )
+  {
+    printf( "%-12s %10d bytes, %d in use, %d at peak, %u failed\n",
+            "arena", m_size, m_used, m_peak, m_failures );
+  }
+  else
+  {
+    printf( "%-12s %10u allocations from malloc\n", "heap", s_heapAllocs );
+  }
+}
+//-----------------------------------------------------------------------------
+void * PspMdArena::Allocate(size_t size_)
+{
+  if ( s_active != NULL )
+    return s_active->carve( size_ );
+
+  const unsigned int size = alignUp( size_ );
+  Block * block = (Block *)malloc( sizeof( Block ) + size );
+  if ( block == NULL )
+    return NULL;
+
+  block->size = size;
+  block->tag = s_tag;
+  block->used = 1;
+
+  s_heapAllocs++;
+  s_bytes[ s_tag ] += size;
+  s_blocks[ s_tag ]++;
+  if ( s_bytes[ s_tag ] > s_peak[ s_tag ] )
+    s_peak[ s_tag ] = s_bytes[ s_tag ];
+
+  return block + 1;
+}
+//-----------------------------------------------------------------------------
+void PspMdArena::Free(void * p_)
+{
+  if ( p_ == NULL )
+    return;
+
+  Block * block = (Block *)p_ - 1;
+  s_bytes[ block->tag ] -= block->size;
+  s_blocks[ block->tag ]--;
+
+  // Blocks handed out before the arena was reserved go back to the heap
+  if ( s_active != NULL && s_active->contains( p_ ) )
+    s_active->release( block );
+  else
+    free( block );
+}
+//-----------------------------------------------------------------------------
+void * PspMdArena::carve(size_t size_)
+{
+  // First fit. Free neighbours are merged on the way, there are a few
+  // dozen blocks at most and this only runs when a buffer is rebuilt.
+  const unsigned int size = alignUp( size_ );
+  char * const end = m_base + m_size;
+
+  for ( char * p = m_base; p < end; )
+  {
+    Block * block = (Block *)p;
+    char * next = p + sizeof( Block ) + block->size;
+
+    if ( block->used )
+    {
+      p = next;
+      continue;
+    }
+
+    while ( next < end && !( (Block *)next )->used )
+    {
+      block->size += sizeof( Block ) + ( (Block *)next )->size;
+      next = p + sizeof( Block ) + block->size;
+    }
+
+    if ( block->size < size )
+    {
+      p = next;
+      continue;
+    }
+
+    // Split off the rest when it can hold another block
+    if ( block->size >= size + sizeof( Block ) + c_align )
+    {
+      Block * rest = (Block *)( p + sizeof( Block ) + size );
+      rest->size = block->size - size - sizeof( Block );
+      rest->tag = TAG_OTHER;
+      rest->used = 0;
+      block->size = size;
+    }
+
+    block->tag = s_tag;
+    block->used = 1;
+
+    m_used += sizeof( Block ) + block->size;
+    if ( m_used > m_peak )
+      m_peak = m_used;
+
+    s_bytes[ s_tag ] += block->size;
+    s_blocks[ s_tag ]++;
+    if ( s_bytes[ s_tag ] > s_peak[ s_tag ] )
+      s_peak[ s_tag ] = s_bytes[ s_tag ];
+
+    return block + 1;
+  }
+
+  m_failures++;
+  return NULL;
+}
+//-----------------------------------------------------------------------------
+void PspMdArena::release(Block * block_)
+{
+  m_used -= sizeof( Block ) + block_->size;
+  block_->used = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
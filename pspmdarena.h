@@ -0,0 +1,113 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDARENA_H
+#define PSPMDARENA_H
+
+#include <stddef.h>
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdArena
+//
+// One region reserved at startup that every buffer of the daemon is carved
+// from. The global new and delete operators are routed to the active arena,
+// so the subsystems keep their plain new[] and delete[]; a buffer rebuilt
+// after a mode switch goes back into the region and is taken again by the
+// next one. Once an arena is active the heap is never touched, and running
+// out of room fails the allocation instead of falling back to malloc.
+//
+// Without an arena the operators go to malloc. Either way every block is
+// charged to the subsystem named by the innermost Scope, which gives the
+// footprint table printed by Report().
+//-----------------------------------------------------------------------------
+class PspMdArena
+{
+public:
+  enum Tag
+  {
+    TAG_OTHER = 0,
+    TAG_GEOMETRY,
+    TAG_BLEND,
+    TAG_ATTR,
+    TAG_POINTER,
+    TAG_SNAPSHOT,
+    TAG_SEARCH,
+    TAG_SELECTION,
+    TAG_CLIPBOARD,
+    TAG_CODES,
+    TAG_MAX
+  };
+
+  // Charges the allocations made during its lifetime to a subsystem
+  class Scope
+  {
+  public:
+    explicit Scope(Tag tag_) : m_saved( s_tag )  { s_tag = tag_; }
+    ~Scope()                                     { s_tag = m_saved; }
+
+  private:
+    Tag m_saved;
+
+    // Not implemented
+    Scope(const Scope &);
+    Scope & operator = (const Scope &);
+  };
+
+  PspMdArena();
+  ~PspMdArena();
+
+  bool Initialize(int size_);
+  void Report() const;
+
+  bool IsEnabled() const          { return m_base != NULL; }
+  int GetSize() const             { return m_size; }
+  int GetUsed() const             { return m_used; }
+
+  static void * Allocate(size_t size_);
+  static void Free(void * p_);
+  static unsigned int GetHeapAllocs()   { return s_heapAllocs; }
+
+protected:
+  struct Block
+  {
+    unsigned int    size;       // Payload bytes following the header
+    unsigned short  tag;
+    unsigned short  used;
+  };
+
+  void * carve(size_t size_);
+  void release(Block * block_);
+  bool contains(const void * p_) const
+  {
+    return (const char *)p_ >= m_base && (const char *)p_ < m_base + m_size;
+  }
+
+  char *          m_base;
+  int             m_size;
+  int             m_used;       // Bytes in blocks, headers included
+  int             m_peak;
+  unsigned int    m_failures;
+
+  static PspMdArena *   s_active;
+  static Tag            s_tag;
+  static unsigned int   s_heapAllocs;     // Blocks taken from malloc
+  static unsigned int   s_bytes[ TAG_MAX ];
+  static unsigned int   s_peak[ TAG_MAX ];
+  static unsigned int   s_blocks[ TAG_MAX ];
+
+private:
+  // Not implemented
+  PspMdArena(const PspMdArena &);
+  PspMdArena & operator = (const PspMdArena &);
+};
+
+
+#endif  // PSPMDARENA_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
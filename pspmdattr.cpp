@@ -0,0 +1,348 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+static const int c_vcsaHeaderSize         = 4;  // Rows, cols, cursor x, y
+static const int c_vcsaCellSize           = 2;  // Character, attribute
+static const unsigned char c_markSwapped  = 0x80;
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+static inline unsigned char swapColors(unsigned char attr_)
+{
+  // Blink and bright stay with their fields, as the console's own reverse
+  // video leaves them
+  return (unsigned char)( ( attr_ & 0x88 ) |
+                          ( ( attr_ & 0x70 ) >> 4 ) |
+                          ( ( attr_ & 0x07 ) << 4 ) );
+}
+//-----------------------------------------------------------------------------
+static inline bool isShown(unsigned char marks_)
+{
+  // A cursor over a highlight cancels out, as with the XOR renderer
+  return ( ( marks_ & PspMdAttr::MARK_CURSOR ) != 0 ) !=
+         ( ( marks_ & PspMdAttr::MARK_HIGHLIGHT ) != 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdAttr
+//-----------------------------------------------------------------------------
+PspMdAttr::PspMdAttr()
+  : m_fd( INVALID_FD ),
+    m_persist( NULL ),
+    m_marks( NULL ),
+    m_written( NULL ),
+    m_rowFrom( NULL ),
+    m_rowTo( NULL ),
+    m_rowBuf( NULL ),
+    m_cols( 0 ),
+    m_rows( 0 ),
+    m_pending( false )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdAttr::~PspMdAttr()
+{
+  Close();
+
+  delete[] m_marks;
+  delete[] m_written;
+  delete[] m_rowFrom;
+  delete[] m_rowTo;
+  delete[] m_rowBuf;
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::Initialize(const char * devName_)
+{
+  if ( m_fd >= 0 )
+  {
+    DBG(( DBG_PREFIX "PspMdAttr has been initialized\n" ));
+    return true;
+  }
+
+  m_fd = open( devName_, O_RDWR );
+  if ( m_fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to open %s, err=%d\n", devName_, errno ));
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdAttr::Close()
+{
+  if ( m_fd >= 0 )
+  {
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::Build(int cols_, int rows_)
+{
+  if ( m_fd < 0 )
+    return true;
+
+  // Unswaps still pending go out at the old size, the marks that called
+  // for them are dropped below
+  (void)Flush();
+
+  if ( cols_ != m_cols || rows_ != m_rows )
+  {
+    PspMdArena::Scope scope( PspMdArena::TAG_ATTR );
+    delete[] m_marks;
+    delete[] m_written;
+    delete[] m_rowFrom;
+    delete[] m_rowTo;
+    delete[] m_rowBuf;
+
+    m_marks = new unsigned char[ cols_ * rows_ ];
+    m_written = new unsigned char[ cols_ * rows_ ];
+    m_rowFrom = new int[ rows_ ];
+    m_rowTo = new int[ rows_ ];
+    m_rowBuf = new unsigned char[ cols_ * c_vcsaCellSize ];
+
+    if ( m_marks == NULL || m_written == NULL || m_rowFrom == NULL ||
+         m_rowTo == NULL || m_rowBuf == NULL )
+    {
+      DBG(( DBG_PREFIX "Failed to allocate the attribute marks\n" ));
+      m_cols = 0;
+      m_rows = 0;
+      return false;
+    }
+
+    m_cols = cols_;
+    m_rows = rows_;
+  }
+
+  Discard();
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdAttr::Discard()
+{
+  // The console has redrawn itself, nothing it shows is swapped any more
+  if ( m_marks == NULL )
+    return;
+
+  memset( m_marks, 0, m_cols * m_rows );
+  for ( int i = 0; i < m_rows; i++ )
+  {
+    m_rowFrom[ i ] = m_cols;
+    m_rowTo[ i ] = -1;
+  }
+
+  if ( m_persist != NULL )
+    m_persist->ClearSwapped();
+
+  m_pending = false;
+}
+//-----------------------------------------------------------------------------
+void PspMdAttr::Scroll(int cells_)
+{
+  // The swapped attributes went up with the text, the rows coming in at
+  // the bottom are not swapped
+  const int cells = m_cols * m_rows;
+  if ( m_marks == NULL || cells_ <= 0 )
+    return;
+
+  if ( cells_ >= cells )
+  {
+    Discard();
+    return;
+  }
+
+  memmove( m_marks, m_marks + cells_, cells - cells_ );
+  memmove( m_written, m_written + cells_, cells - cells_ );
+  memset( m_marks + cells - cells_, 0, cells_ );
+
+  if ( m_persist != NULL )
+    m_persist->ScrollSwapped( cells_ );
+
+  // Pending spans are flushed whole rather than moved
+  for ( int i = 0; i < m_rows; i++ )
+  {
+    if ( m_rowFrom[ i ] <= m_rowTo[ i ] )
+    {
+      m_rowFrom[ i ] = 0;
+      m_rowTo[ i ] = m_cols - 1;
+    }
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::Mark(int cell_, unsigned int marks_)
+{
+  if ( ( m_marks[ cell_ ] & marks_ ) == marks_ )
+    return false;
+
+  m_marks[ cell_ ] |= marks_;
+  touch( cell_ );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::Unmark(int cell_, unsigned int marks_)
+{
+  if ( ( m_marks[ cell_ ] & marks_ ) == 0 )
+    return false;
+
+  m_marks[ cell_ ] &= ~marks_;
+  touch( cell_ );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::Flush()
+{
+  if ( !m_pending )
+    return true;
+
+  bool ok = true;
+  for ( int row = 0; row < m_rows; row++ )
+  {
+    if ( m_rowFrom[ row ] > m_rowTo[ row ] )
+      continue;
+
+    if ( !flushRow( row, m_rowFrom[ row ], m_rowTo[ row ] ) )
+      ok = false;
+
+    m_rowFrom[ row ] = m_cols;
+    m_rowTo[ row ] = -1;
+  }
+
+  m_pending = false;
+  return ok;
+}
+//-----------------------------------------------------------------------------
+void PspMdAttr::Attach(PspMdPersist & persist_)
+{
+  m_persist = &persist_;
+}
+//-----------------------------------------------------------------------------
+int PspMdAttr::Restore(PspMdPersist & persist_)
+{
+  // Cells a previous instance left swapped are taken as swapped and not
+  // shown, the next Flush() puts them back unless the console has since
+  // rewritten them
+  Attach( persist_ );
+  if ( m_marks == NULL )
+    return 0;
+
+  int restored = 0;
+  for ( int cell = persist_.NextSwapped( 0 );
+        cell >= 0 && cell < m_cols * m_rows;
+        cell = persist_.NextSwapped( cell + 1 ) )
+  {
+    m_marks[ cell ] |= c_markSwapped;
+    m_written[ cell ] = persist_.GetWritten( cell );
+    touch( cell );
+    restored++;
+  }
+
+  return restored;
+}
+//-----------------------------------------------------------------------------
+void PspMdAttr::touch(int cell_)
+{
+  const int row = cell_ / m_cols;
+  const int col = cell_ - row * m_cols;
+
+  if ( col < m_rowFrom[ row ] )
+    m_rowFrom[ row ] = col;
+  if ( col > m_rowTo[ row ] )
+    m_rowTo[ row ] = col;
+
+  m_pending = true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdAttr::flushRow(int row_, int from_, int to_)
+{
+  // The span is read whole, but only the attributes that change go back,
+  // one byte each at their odd offset. The characters are never written,
+  // so output that lands in between is kept.
+  const int first = row_ * m_cols + from_;
+  const int size = ( to_ - from_ + 1 ) * c_vcsaCellSize;
+  const off_t offset = c_vcsaHeaderSize + first * c_vcsaCellSize;
+
+  if ( pread( m_fd, m_rowBuf, size, offset ) != size )
+  {
+    DBG(( DBG_PREFIX "Failed to read the attributes, err=%d\n", errno ));
+    return false;
+  }
+
+  bool ok = true;
+  for ( int i = 0; i <= to_ - from_; i++ )
+  {
+    unsigned char & marks = m_marks[ first + i ];
+    const bool swapped = ( marks & c_markSwapped ) != 0;
+    if ( isShown( marks ) == swapped )
+      continue;
+
+    const unsigned char attr = m_rowBuf[ i * c_vcsaCellSize + 1 ];
+    const off_t attrOffset = offset + i * c_vcsaCellSize + 1;
+    if ( !swapped )
+    {
+      // Recorded before it is written, a crash in between only costs a
+      // comparison on restore
+      const unsigned char swap = swapColors( attr );
+      if ( m_persist != NULL )
+        m_persist->MarkSwapped( first + i, swap );
+
+      if ( pwrite( m_fd, &swap, 1, attrOffset ) != 1 )
+      {
+        if ( m_persist != NULL )
+          m_persist->UnmarkSwapped( first + i );
+        ok = false;
+        continue;
+      }
+
+      m_written[ first + i ] = swap;
+      marks |= c_markSwapped;
+    }
+    else
+    {
+      // Output since the swap owns the cell now
+      if ( attr == m_written[ first + i ] )
+      {
+        const unsigned char swap = swapColors( attr );
+        if ( pwrite( m_fd, &swap, 1, attrOffset ) != 1 )
+        {
+          ok = false;
+          continue;
+        }
+      }
+      marks &= ~c_markSwapped;
+      if ( m_persist != NULL )
+        m_persist->UnmarkSwapped( first + i );
+    }
+  }
+
+  if ( !ok )
+  {
+    DBG(( DBG_PREFIX "Failed to write the attributes, err=%d\n", errno ));
+  }
+
+  return ok;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
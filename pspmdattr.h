@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDATTR_H
+#define PSPMDATTR_H
+
+class PspMdPersist;
+
+//-----------------------------------------------------------------------------
+// Class: PspMdAttr
+//
+// Attribute renderer. A marked cell is shown by swapping the foreground
+// and background colours of its attribute byte through /dev/vcsa, and the
+// console driver redraws the glyph. Marks are only recorded when a cell is
+// drawn or cleared; Flush() then reads one span per changed row and writes
+// back only the attribute bytes that change, so the characters the console
+// prints in between are never overwritten.
+//
+// As with the XOR renderer, a cursor and a highlight on the same cell
+// cancel out. A cell the console has rewritten since the swap keeps the
+// new attribute when it is cleared. Once attached, the swapped cells are
+// kept in the state segment as well, so that the next instance can put
+// them back after a crash.
+//-----------------------------------------------------------------------------
+class PspMdAttr
+{
+public:
+  enum
+  {
+    MARK_CURSOR     = 0x1,
+    MARK_HIGHLIGHT  = 0x2
+  };
+
+  PspMdAttr();
+  ~PspMdAttr();
+
+  bool Initialize(const char * devName_);
+  void Close();
+  bool Build(int cols_, int rows_);
+  void Discard();
+  void Scroll(int cells_);
+  bool Mark(int cell_, unsigned int marks_);
+  bool Unmark(int cell_, unsigned int marks_);
+  bool Flush();
+  void Attach(PspMdPersist & persist_);
+  int Restore(PspMdPersist & persist_);
+
+  bool IsEnabled() const  { return m_fd >= 0; }
+  bool IsPending() const  { return m_pending; }
+
+protected:
+  void touch(int cell_);
+  bool flushRow(int row_, int from_, int to_);
+
+  int               m_fd;
+  PspMdPersist *    m_persist;    // Mirror of the swapped cells, or NULL
+  unsigned char *   m_marks;      // MARK_* bits per cell, and whether the
+                                  // attribute is swapped
+  unsigned char *   m_written;    // Attribute written to a swapped cell
+  int *             m_rowFrom;    // Changed span of every row, from > to
+  int *             m_rowTo;      // when the row is untouched
+  unsigned char *   m_rowBuf;     // Characters and attributes of a span
+  int               m_cols;
+  int               m_rows;
+  bool              m_pending;
+
+private:
+  // Not implemented
+  PspMdAttr(const PspMdAttr &);
+  PspMdAttr & operator = (const PspMdAttr &);
+};
+
+
+#endif  // PSPMDATTR_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
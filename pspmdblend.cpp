@@ -0,0 +1,288 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const unsigned int c_lanes32       = 0x00ff00ff;
+static const unsigned int c_green32       = 0x0000ff00;
+static const unsigned int c_marker32      = 0xff000000;
+static const unsigned int c_lanes565      = 0x07e0f81f;  // G, then R and B
+static const int          c_shift565      = 5;
+
+
+//-----------------------------------------------------------------------------
+// Pixel formats
+//
+// Each format blends one pixel with the weights prepared by Initialize().
+// The rectangle loop is instantiated once per format, so the per-pixel
+// code is straight line without a test of the pixel size.
+//-----------------------------------------------------------------------------
+struct PspMdRgb8888
+{
+  typedef unsigned int Pixel;
+
+  static Pixel Blend(Pixel pixel_,
+                     unsigned int inverse_,
+                     unsigned int tintLo_,
+                     unsigned int tintHi_)
+  {
+    // Each lane holds channel * inverse + tint * alpha <= 255 * 256, so the
+    // products never carry into the neighbouring lane
+    const unsigned int rb = ( pixel_ & c_lanes32 ) * inverse_ + tintLo_;
+    const unsigned int ag = ( ( pixel_ >> 8 ) & c_lanes32 ) * inverse_ + tintHi_;
+
+    return ( ( rb >> 8 ) & c_lanes32 ) |
+           ( ag & c_green32 ) |
+           ( pixel_ & c_marker32 );
+  }
+};
+//-----------------------------------------------------------------------------
+struct PspMdRgb565
+{
+  typedef unsigned short Pixel;
+
+  static Pixel Blend(Pixel pixel_,
+                     unsigned int inverse_,
+                     unsigned int tintLo_,
+                     unsigned int)
+  {
+    // Green moves to the top half of the word, leaving five spare bits
+    // above every channel for the product with a five bit alpha
+    unsigned int x = ( pixel_ | ( pixel_ << 16 ) ) & c_lanes565;
+    x = ( ( x * inverse_ + tintLo_ ) >> c_shift565 ) & c_lanes565;
+    return (Pixel)( x | ( x >> 16 ) );
+  }
+};
+//-----------------------------------------------------------------------------
+template <class Format>
+static void blendRect
+(
+  unsigned char * start_,
+  int lineLength_,
+  int width_,
+  int height_,
+  unsigned int inverse_,
+  unsigned int tintLo_,
+  unsigned int tintHi_
+)
+{
+  for ( int i = 0; i < height_; i++ )
+  {
+    typename Format::Pixel * p = (typename Format::Pixel *)start_;
+    for ( int j = 0; j < width_; j++ )
+      p[ j ] = Format::Blend( p[ j ], inverse_, tintLo_, tintHi_ );
+
+    start_ += lineLength_;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Class: PspMdBlend
+//-----------------------------------------------------------------------------
+PspMdBlend::PspMdBlend()
+  : m_bytesPerPixel( 0 ),
+    m_inverse( 0 ),
+    m_tintLo( 0 ),
+    m_tintHi( 0 ),
+    m_shadow( NULL ),
+    m_applied( NULL ),
+    m_shadowStride( 0 ),
+    m_shadowSize( 0 ),
+    m_cells( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdBlend::~PspMdBlend()
+{
+  delete[] m_shadow;
+  delete[] m_applied;
+}
+//-----------------------------------------------------------------------------
+bool PspMdBlend::Initialize(int bytesPerPixel_, unsigned int tint_, int alpha_)
+{
+  if ( alpha_ <= 0 || alpha_ > 255 )
+  {
+    DBG(( DBG_PREFIX "Invalid highlight alpha %d\n", alpha_ ));
+    return false;
+  }
+
+  // Alpha 255 must cover the pixel completely, so scale it to 0..256
+  const unsigned int alpha = alpha_ + ( alpha_ >> 7 );
+
+  if ( bytesPerPixel_ == sizeof( unsigned int ) )
+  {
+    m_inverse = 256 - alpha;
+    m_tintLo  = ( tint_ & c_lanes32 ) * alpha;
+    m_tintHi  = ( ( tint_ >> 8 ) & c_lanes32 ) * alpha;
+  }
+  else if ( bytesPerPixel_ == sizeof( unsigned short ) )
+  {
+    // Five bits of alpha, the widest that keeps the 565 lanes apart
+    const unsigned int alpha565 = ( alpha + 4 ) >> 3;
+    m_inverse = ( 1 << c_shift565 ) - alpha565;
+    m_tintLo  = ( ( tint_ | ( tint_ << 16 ) ) & c_lanes565 ) * alpha565;
+    m_tintHi  = 0;
+  }
+  else
+  {
+    DBG(( DBG_PREFIX "Blending needs a 16bpp or 32bpp framebuffer\n" ));
+    return false;
+  }
+
+  m_bytesPerPixel = bytesPerPixel_;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdBlend::Build(int width_, int height_, int cells_)
+{
+  if ( m_bytesPerPixel == 0 )
+    return true;
+
+  PspMdArena::Scope scope( PspMdArena::TAG_BLEND );
+  const int size = width_ * height_ * m_bytesPerPixel;
+  if ( m_shadow == NULL || size != m_shadowSize )
+  {
+    delete[] m_shadow;
+    m_shadow = new unsigned char[ size ];
+    m_shadowSize = ( m_shadow != NULL ) ? size : 0;
+  }
+
+  if ( m_applied == NULL || cells_ != m_cells )
+  {
+    delete[] m_applied;
+    m_applied = new unsigned char[ cells_ ];
+    m_cells = ( m_applied != NULL ) ? cells_ : 0;
+  }
+
+  if ( m_shadow == NULL || m_applied == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to allocate the blend shadow, size=%d\n",
+          size ));
+    return false;
+  }
+
+  m_shadowStride = width_ * m_bytesPerPixel;
+  Discard();
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdBlend::Discard()
+{
+  // The saved pixels no longer match the screen, e.g. after a pan
+  if ( m_applied != NULL )
+    memset( m_applied, 0, m_cells );
+}
+//-----------------------------------------------------------------------------
+void PspMdBlend::Scroll(int dy_, int cells_)
+{
+  // Follow the text up by dy_ pixel rows and cells_ cells, the rows
+  // coming in at the bottom are not tinted
+  if ( m_applied == NULL || dy_ <= 0 || cells_ <= 0 )
+    return;
+
+  const int bytes = dy_ * m_shadowStride;
+  if ( bytes >= m_shadowSize || cells_ >= m_cells )
+  {
+    Discard();
+    return;
+  }
+
+  memmove( m_shadow, m_shadow + bytes, m_shadowSize - bytes );
+  memmove( m_applied, m_applied + cells_, m_cells - cells_ );
+  memset( m_applied + m_cells - cells_, 0, cells_ );
+}
+//-----------------------------------------------------------------------------
+bool PspMdBlend::Apply
+(
+  int cell_,
+  unsigned char * start_,
+  int lineLength_,
+  int x_,
+  int y_,
+  int width_,
+  int height_
+)
+{
+  if ( m_applied[ cell_ ] )
+    return false;
+
+  copyRect( m_shadow + y_ * m_shadowStride + x_ * m_bytesPerPixel,
+            m_shadowStride,
+            start_,
+            lineLength_,
+            width_ * m_bytesPerPixel,
+            height_ );
+
+  if ( m_bytesPerPixel == sizeof( PspMdRgb8888::Pixel ) )
+  {
+    blendRect<PspMdRgb8888>( start_, lineLength_, width_, height_,
+                             m_inverse, m_tintLo, m_tintHi );
+  }
+  else
+  {
+    blendRect<PspMdRgb565>( start_, lineLength_, width_, height_,
+                            m_inverse, m_tintLo, m_tintHi );
+  }
+
+  m_applied[ cell_ ] = 1;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdBlend::Restore
+(
+  int cell_,
+  unsigned char * start_,
+  int lineLength_,
+  int x_,
+  int y_,
+  int width_,
+  int height_
+)
+{
+  if ( !m_applied[ cell_ ] )
+    return false;
+
+  copyRect( start_,
+            lineLength_,
+            m_shadow + y_ * m_shadowStride + x_ * m_bytesPerPixel,
+            m_shadowStride,
+            width_ * m_bytesPerPixel,
+            height_ );
+
+  m_applied[ cell_ ] = 0;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdBlend::copyRect
+(
+  unsigned char * to_,
+  int toStride_,
+  const unsigned char * from_,
+  int fromStride_,
+  int bytes_,
+  int height_
+)
+{
+  for ( int i = 0; i < height_; i++ )
+  {
+    memcpy( to_, from_, bytes_ );
+    to_ += toStride_;
+    from_ += fromStride_;
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
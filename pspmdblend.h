@@ -0,0 +1,80 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDBLEND_H
+#define PSPMDBLEND_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdBlend
+//
+// Alpha blended highlight. A cell is tinted in place after its pixels are
+// saved to a shadow copy of the screen, and restored from that copy, so
+// no rounding error survives a draw and clear. Whether a cell is tinted is
+// kept in a flag per cell instead of marker bits in the pixels, which lets
+// the same code run on 16bpp.
+//
+// The kernels are SWAR: on 32bpp the red and blue channels share one
+// multiply and green the other, each lane with room for the product; on
+// 16bpp a RGB565 pixel is spread over a word so that its three channels
+// blend with a single multiply. The top byte of a 32bpp pixel is left
+// alone, it carries the cursor marker of the XOR renderer.
+//-----------------------------------------------------------------------------
+class PspMdBlend
+{
+public:
+  PspMdBlend();
+  ~PspMdBlend();
+
+  bool Initialize(int bytesPerPixel_, unsigned int tint_, int alpha_);
+  bool Build(int width_, int height_, int cells_);
+  void Discard();
+  void Scroll(int dy_, int cells_);
+  bool Apply(int cell_,
+             unsigned char * start_,
+             int lineLength_,
+             int x_,
+             int y_,
+             int width_,
+             int height_);
+  bool Restore(int cell_,
+               unsigned char * start_,
+               int lineLength_,
+               int x_,
+               int y_,
+               int width_,
+               int height_);
+
+  bool IsEnabled() const          { return m_bytesPerPixel != 0; }
+  bool IsApplied(int cell_) const { return m_applied[ cell_ ] != 0; }
+
+protected:
+  static void copyRect(unsigned char * to_, int toStride_,
+                       const unsigned char * from_, int fromStride_,
+                       int bytes_, int height_);
+
+  int               m_bytesPerPixel;
+  unsigned int      m_inverse;      // Weight of the original pixel
+  unsigned int      m_tintLo;       // Weighted tint, low lane pair or 565
+  unsigned int      m_tintHi;       // Weighted tint, high lane pair
+  unsigned char *   m_shadow;       // Original pixels of the tinted cells
+  unsigned char *   m_applied;      // One flag per console cell
+  int               m_shadowStride;
+  int               m_shadowSize;
+  int               m_cells;
+
+private:
+  // Not implemented
+  PspMdBlend(const PspMdBlend &);
+  PspMdBlend & operator = (const PspMdBlend &);
+};
+
+
+#endif  // PSPMDBLEND_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
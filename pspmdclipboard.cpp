@@ -0,0 +1,177 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdClipboard
+//-----------------------------------------------------------------------------
+PspMdClipboard::PspMdClipboard()
+  : m_head( NULL ),
+    m_tail( NULL ),
+    m_free( NULL ),
+    m_size( 0 ),
+    m_chunks( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdClipboard::~PspMdClipboard()
+{
+  Clear();
+
+  while ( m_free != NULL )
+  {
+    Chunk * next = m_free->next;
+    delete m_free;
+    m_free = next;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdClipboard::Prepare(int size_)
+{
+  // Allocate up front what a copy of size_ bytes needs
+  PspMdArena::Scope scope( PspMdArena::TAG_CLIPBOARD );
+  while ( m_chunks * CHUNK_SIZE < size_ )
+  {
+    Chunk * chunk = new Chunk;
+    if ( chunk == NULL )
+    {
+      DBG(( DBG_PREFIX "Failed to allocate a clipboard chunk\n" ));
+      return false;
+    }
+
+    chunk->next = m_free;
+    m_free = chunk;
+    m_chunks++;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdClipboard::Clear()
+{
+  if ( m_tail == NULL )
+    return;
+
+  m_tail->next = m_free;
+  m_free = m_head;
+  m_head = NULL;
+  m_tail = NULL;
+  m_size = 0;
+}
+//-----------------------------------------------------------------------------
+char * PspMdClipboard::Extend(int size_)
+{
+  if ( size_ <= 0 || size_ > CHUNK_SIZE )
+    return NULL;
+
+  if ( ( m_tail == NULL || m_tail->size + size_ > CHUNK_SIZE ) &&
+       addChunk() == NULL )
+  {
+    return NULL;
+  }
+
+  char * space = m_tail->data + m_tail->size;
+  m_tail->size += size_;
+  m_size += size_;
+  return space;
+}
+//-----------------------------------------------------------------------------
+void PspMdClipboard::Shrink(int size_)
+{
+  // Only the end of the last chunk can be given back, which is all a
+  // short read after Extend() needs
+  if ( m_tail == NULL )
+    return;
+
+  if ( size_ > m_tail->size )
+    size_ = m_tail->size;
+
+  m_tail->size -= size_;
+  m_size -= size_;
+}
+//-----------------------------------------------------------------------------
+bool PspMdClipboard::Append(const char * text_, int size_)
+{
+  while ( size_ > 0 )
+  {
+    if ( ( m_tail == NULL || m_tail->size == CHUNK_SIZE ) &&
+         addChunk() == NULL )
+    {
+      return false;
+    }
+
+    int length = CHUNK_SIZE - m_tail->size;
+    if ( length > size_ )
+      length = size_;
+
+    memcpy( m_tail->data + m_tail->size, text_, length );
+    m_tail->size += length;
+    m_size += length;
+    text_ += length;
+    size_ -= length;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+char * PspMdClipboard::GetRecord(int index_, int size_) const
+{
+  if ( index_ < 0 || size_ <= 0 || size_ > CHUNK_SIZE )
+    return NULL;
+
+  const int perChunk = CHUNK_SIZE / size_;
+  Chunk * chunk = m_head;
+  for ( int i = index_ / perChunk; i > 0 && chunk != NULL; i-- )
+    chunk = chunk->next;
+
+  const int offset = ( index_ % perChunk ) * size_;
+  if ( chunk == NULL || offset + size_ > chunk->size )
+    return NULL;
+
+  return chunk->data + offset;
+}
+//-----------------------------------------------------------------------------
+PspMdClipboard::Chunk * PspMdClipboard::addChunk()
+{
+  Chunk * chunk = m_free;
+  if ( chunk != NULL )
+  {
+    m_free = chunk->next;
+  }
+  else
+  {
+    PspMdArena::Scope scope( PspMdArena::TAG_CLIPBOARD );
+    chunk = new Chunk;
+    if ( chunk == NULL )
+    {
+      DBG(( DBG_PREFIX "Failed to allocate a clipboard chunk\n" ));
+      return NULL;
+    }
+
+    m_chunks++;
+  }
+
+  chunk->next = NULL;
+  chunk->size = 0;
+
+  if ( m_tail != NULL )
+    m_tail->next = chunk;
+  else
+    m_head = chunk;
+  m_tail = chunk;
+
+  return chunk;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,67 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDCLIPBOARD_H
+#define PSPMDCLIPBOARD_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdClipboard
+//
+// Text kept in a list of fixed size chunks, so a copy of any length grows
+// the store a chunk at a time and never moves what is already in it.
+// Cleared chunks go to a free list and are taken again by the next copy,
+// after the first few copies nothing is allocated any more. Records of one
+// size handed out by Extend() never straddle two chunks, which lets the
+// same store hold an array of console lines.
+//-----------------------------------------------------------------------------
+class PspMdClipboard
+{
+public:
+  enum { CHUNK_SIZE = 4096 };
+
+  struct Chunk
+  {
+    Chunk * next;
+    int     size;
+    char    data[ CHUNK_SIZE ];
+  };
+
+  PspMdClipboard();
+  ~PspMdClipboard();
+
+  bool Prepare(int size_);
+  void Clear();
+  char * Extend(int size_);
+  void Shrink(int size_);
+  bool Append(const char * text_, int size_);
+  char * GetRecord(int index_, int size_) const;
+
+  const Chunk * GetFirst() const  { return m_head; }
+  int GetSize() const             { return m_size; }
+  bool IsEmpty() const            { return m_size == 0; }
+
+protected:
+  Chunk * addChunk();
+
+  Chunk * m_head;
+  Chunk * m_tail;
+  Chunk * m_free;
+  int     m_size;           // Bytes in use
+  int     m_chunks;         // Chunks allocated, in use or free
+
+private:
+  // Not implemented
+  PspMdClipboard(const PspMdClipboard &);
+  PspMdClipboard & operator = (const PspMdClipboard &);
+};
+
+
+#endif  // PSPMDCLIPBOARD_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
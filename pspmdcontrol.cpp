@@ -0,0 +1,166 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdControl
+//-----------------------------------------------------------------------------
+PspMdControl::PspMdControl()
+  : m_fd( INVALID_FD ),
+    m_payloadSize( 0 ),
+    m_peerSize( 0 )
+{
+  memset( &m_address, 0, sizeof( m_address ) );
+  memset( &m_request, 0, sizeof( m_request ) );
+  memset( &m_peer, 0, sizeof( m_peer ) );
+}
+//-----------------------------------------------------------------------------
+PspMdControl::~PspMdControl()
+{
+  if ( m_fd >= 0 )
+  {
+    (void)close( m_fd );
+    (void)unlink( m_address.sun_path );
+    m_fd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdControl::Initialize(const char * fileName_, int fd_)
+{
+  if ( m_fd >= 0 )
+  {
+    DBG(( DBG_PREFIX "PspMdControl has been initialized\n" ));
+    return true;
+  }
+
+  if ( strlen( fileName_ ) >= sizeof( m_address.sun_path ) )
+  {
+    DBG(( DBG_PREFIX "Control socket name too long: %s\n", fileName_ ));
+    return false;
+  }
+
+  m_address.sun_family = AF_UNIX;
+  strcpy( m_address.sun_path, fileName_ );
+
+  // A socket handed over is still bound, clients keep sending to it
+  if ( fd_ >= 0 )
+  {
+    m_fd = fd_;
+    return true;
+  }
+
+  m_fd = socket( AF_UNIX, SOCK_DGRAM, 0 );
+  if ( m_fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to create the control socket, err=%d\n",
+          errno ));
+    return false;
+  }
+
+  // A socket left behind by a previous run would fail the bind
+  (void)unlink( fileName_ );
+
+  if ( bind( m_fd, (struct sockaddr *)&m_address, sizeof( m_address ) ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to bind the control socket %s, err=%d\n",
+          fileName_, errno ));
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdControl::Disown()
+{
+  // The next instance serves the socket now, its file stays
+  if ( m_fd >= 0 )
+  {
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdControl::Receive()
+{
+  m_payloadSize = 0;
+  m_peerSize = sizeof( m_peer );
+
+  const int rt = recvfrom( m_fd, &m_request, sizeof( m_request ),
+                           MSG_DONTWAIT,
+                           (struct sockaddr *)&m_peer, &m_peerSize );
+  if ( rt < 0 )
+  {
+    if ( errno != EAGAIN && errno != EINTR )
+    {
+      DBG(( DBG_PREFIX "Failed to read the control socket, err=%d\n",
+            errno ));
+    }
+    return false;
+  }
+
+  if ( rt < (int)sizeof( PspMdCtlHeader ) ||
+       m_request.header.magic != PSPMD_CTL_MAGIC )
+  {
+    DBG(( DBG_PREFIX "Dropped a malformed control batch of %d bytes\n", rt ));
+    return false;
+  }
+
+  m_payloadSize = rt - sizeof( PspMdCtlHeader );
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdControl::Reply
+(
+  int status_,
+  unsigned int accepted_,
+  unsigned int processed_,
+  unsigned int usec_
+)
+{
+  // An unnamed client cannot be answered
+  if ( m_peerSize <= (socklen_t)sizeof( sa_family_t ) )
+    return true;
+
+  PspMdCtlReply reply;
+  reply.magic = PSPMD_CTL_MAGIC;
+  reply.seq = m_request.header.seq;
+  reply.status = status_;
+  reply.accepted = accepted_;
+  reply.processed = processed_;
+  reply.usec = usec_;
+  reply.rate = ( usec_ > 0 ) ?
+               (unsigned int)( processed_ * 1000000ULL / usec_ ) : 0;
+
+  // A client that stopped listening must not stall the daemon
+  if ( sendto( m_fd, &reply, sizeof( reply ), MSG_DONTWAIT,
+               (struct sockaddr *)&m_peer, m_peerSize ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to answer a control batch, err=%d\n", errno ));
+    return false;
+  }
+
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
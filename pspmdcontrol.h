@@ -0,0 +1,138 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDCONTROL_H
+#define PSPMDCONTROL_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+//-----------------------------------------------------------------------------
+// Control protocol
+//
+// A client sends one datagram per batch to the control socket: a header,
+// then the payload of the command. Every batch is answered with one reply
+// datagram to the address it came from, so the client binds its own socket
+// first.
+//
+// PSPMD_CTL_EVENTS carries count PspMdCtlMotion records. They go through
+// the state machine like decoded mouse packets, one event each, without
+// folding motion. PSPMD_CTL_SELECT carries one PspMdCtlSelect and makes a
+// left drag between the two cells. PSPMD_CTL_COPY copies the selection
+// again, PSPMD_CTL_PASTE pastes the clipboard.
+//
+// The reply counts the records accepted from the batch and the events the
+// state machine processed, and the time taken including the redraw; the
+// rate is the processed events per second over that time.
+//-----------------------------------------------------------------------------
+#define PSPMD_CTL_MAGIC       0x43444d50    // "PMDC"
+#define PSPMD_CTL_MAX_EVENTS  512
+
+enum
+{
+  PSPMD_CTL_EVENTS = 1,
+  PSPMD_CTL_SELECT,
+  PSPMD_CTL_COPY,
+  PSPMD_CTL_PASTE
+};
+
+enum
+{
+  PSPMD_CTL_OK = 0,
+  PSPMD_CTL_BAD_REQUEST,
+  PSPMD_CTL_FAILED
+};
+
+struct PspMdCtlHeader
+{
+  unsigned int    magic;
+  unsigned int    seq;        // Echoed in the reply
+  unsigned short  command;
+  unsigned short  count;      // Records in the payload
+};
+
+struct PspMdCtlMotion
+{
+  unsigned short  buttons;    // PspMdMouse::BUTTON_* bits
+  short           dx;         // Pointer motion in pixels
+  short           dy;
+};
+
+struct PspMdCtlSelect
+{
+  short           fromCol;
+  short           fromRow;
+  short           toCol;
+  short           toRow;
+};
+
+struct PspMdCtlReply
+{
+  unsigned int    magic;
+  unsigned int    seq;
+  int             status;
+  unsigned int    accepted;
+  unsigned int    processed;
+  unsigned int    usec;
+  unsigned int    rate;       // Processed events per second
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdControl
+//
+// Server side of the control socket. Receive() takes one batch without
+// blocking; the daemon interprets it and answers with Reply(). A socket
+// handed over by a previous instance is taken with the batches queued in
+// it, and one handed on is left bound for the next instance with Disown().
+//-----------------------------------------------------------------------------
+class PspMdControl
+{
+public:
+  PspMdControl();
+  ~PspMdControl();
+
+  bool Initialize(const char * fileName_, int fd_ = -1);
+  void Disown();
+  bool Receive();
+  bool Reply(int status_,
+             unsigned int accepted_,
+             unsigned int processed_,
+             unsigned int usec_);
+
+  bool IsEnabled() const                    { return m_fd >= 0; }
+  int GetFd() const                         { return m_fd; }
+  const PspMdCtlHeader & GetHeader() const  { return m_request.header; }
+  int GetPayloadSize() const                { return m_payloadSize; }
+  const void * GetPayload() const           { return m_request.payload; }
+
+protected:
+  struct Request
+  {
+    PspMdCtlHeader header;
+    char payload[ PSPMD_CTL_MAX_EVENTS * sizeof( PspMdCtlMotion ) ];
+  };
+
+  int m_fd;
+  struct sockaddr_un m_address;
+  Request m_request;
+  int m_payloadSize;
+  struct sockaddr_un m_peer;    // Sender of the last batch
+  socklen_t m_peerSize;
+
+private:
+  // Not implemented
+  PspMdControl(const PspMdControl &);
+  PspMdControl & operator = (const PspMdControl &);
+};
+
+
+#endif  // PSPMDCONTROL_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,187 @@
+/*-----------------------------------------------------------------------------
+ * Control client for the PSP Mouse Daemon
+ * Feeds numbered batches of synthetic motion to the control socket on the
+ * target and prints the reply to each, one line per batch
+ *---------------------------------------------------------------------------*/
+#include "pspmdcontrol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const char c_controlFileName[]     = "/tmp/pspmd.ctl";
+static const char c_clientFileName[]      = "/tmp/pspmdctl.%d";
+static const int c_replyTimeoutSec        = 15; // Covers a handoff setup
+static const int c_sendRetries            = 50; // Daemon not up yet
+static const int c_retryUsec              = 100000;
+
+
+//-----------------------------------------------------------------------------
+// Prototypes
+//-----------------------------------------------------------------------------
+static int openClient(struct sockaddr_un & client_);
+static bool sendBatch(int fd_, unsigned int seq_, int events_);
+static bool waitReply(int fd_, unsigned int seq_, PspMdCtlReply & reply_);
+
+
+//-----------------------------------------------------------------------------
+// Implementations
+//-----------------------------------------------------------------------------
+int main(int argc_, char * argv_[])
+{
+  if ( argc_ < 3 || argc_ > 4 || strcmp( argv_[ 1 ], "--help" ) == 0 )
+  {
+    printf( "Usage: pspmdctl <batches> <events> [<msec>]\n"
+            "  Sends <batches> batches of <events> motions, <msec> apart,\n"
+            "  and prints: seq status accepted processed usec rate\n" );
+    return 0;
+  }
+
+  const int batches = atoi( argv_[ 1 ] );
+  const int events = atoi( argv_[ 2 ] );
+  const int msec = ( argc_ == 4 ) ? atoi( argv_[ 3 ] ) : 0;
+  if ( batches <= 0 || events <= 0 || events > PSPMD_CTL_MAX_EVENTS ||
+       msec < 0 )
+  {
+    fprintf( stderr, "Invalid batch size\n" );
+    return -1;
+  }
+
+  struct sockaddr_un client;
+  const int fd = openClient( client );
+  if ( fd < 0 )
+    return -1;
+
+  // Every batch is answered before the next goes, a missing reply is a
+  // batch the daemon lost
+  int failed = 0;
+  for ( int i = 1; i <= batches; i++ )
+  {
+    PspMdCtlReply reply;
+    if ( !sendBatch( fd, i, events ) || !waitReply( fd, i, reply ) )
+    {
+      fprintf( stderr, "Batch %d got no reply\n", i );
+      failed = -1;
+      break;
+    }
+
+    printf( "%u %d %u %u %u %u\n", reply.seq, reply.status,
+            reply.accepted, reply.processed, reply.usec, reply.rate );
+    if ( reply.status != PSPMD_CTL_OK ||
+         reply.processed != (unsigned int)events )
+    {
+      failed = -1;
+    }
+
+    if ( msec > 0 )
+      (void)usleep( msec * 1000 );
+  }
+
+  (void)close( fd );
+  (void)unlink( client.sun_path );
+  return failed;
+}
+//-----------------------------------------------------------------------------
+static int openClient(struct sockaddr_un & client_)
+{
+  // Replies go to the address a batch came from, so the client binds one
+  memset( &client_, 0, sizeof( client_ ) );
+  client_.sun_family = AF_UNIX;
+  snprintf( client_.sun_path, sizeof( client_.sun_path ),
+            c_clientFileName, (int)getpid() );
+  (void)unlink( client_.sun_path );
+
+  const int fd = socket( AF_UNIX, SOCK_DGRAM, 0 );
+  if ( fd < 0 ||
+       bind( fd, (struct sockaddr *)&client_, sizeof( client_ ) ) < 0 )
+  {
+    fprintf( stderr, "Failed to bind %s, err=%d\n", client_.sun_path, errno );
+    if ( fd >= 0 )
+      (void)close( fd );
+    return -1;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = c_replyTimeoutSec;
+  tv.tv_usec = 0;
+  (void)setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+
+  return fd;
+}
+//-----------------------------------------------------------------------------
+static bool sendBatch(int fd_, unsigned int seq_, int events_)
+{
+  struct
+  {
+    PspMdCtlHeader header;
+    PspMdCtlMotion motions[ PSPMD_CTL_MAX_EVENTS ];
+  } batch;
+
+  batch.header.magic = PSPMD_CTL_MAGIC;
+  batch.header.seq = seq_;
+  batch.header.command = PSPMD_CTL_EVENTS;
+  batch.header.count = (unsigned short)events_;
+
+  // Back and forth, the pointer ends each batch where it started
+  for ( int i = 0; i < events_; i++ )
+  {
+    batch.motions[ i ].buttons = 0;
+    batch.motions[ i ].dx = ( i & 1 ) ? -1 : 1;
+    batch.motions[ i ].dy = 0;
+  }
+
+  struct sockaddr_un daemon;
+  memset( &daemon, 0, sizeof( daemon ) );
+  daemon.sun_family = AF_UNIX;
+  strcpy( daemon.sun_path, c_controlFileName );
+
+  const int size = sizeof( batch.header ) +
+                   events_ * sizeof( PspMdCtlMotion );
+  for ( int retry = 0; retry < c_sendRetries; retry++ )
+  {
+    if ( sendto( fd_, &batch, size, 0, (struct sockaddr *)&daemon,
+                 sizeof( daemon ) ) == size )
+    {
+      return true;
+    }
+
+    if ( errno != ENOENT && errno != ECONNREFUSED )
+      break;
+
+    (void)usleep( c_retryUsec );
+  }
+
+  fprintf( stderr, "Failed to send to %s, err=%d\n",
+           c_controlFileName, errno );
+  return false;
+}
+//-----------------------------------------------------------------------------
+static bool waitReply(int fd_, unsigned int seq_, PspMdCtlReply & reply_)
+{
+  for ( ;; )
+  {
+    const int rt = recv( fd_, &reply_, sizeof( reply_ ), 0 );
+    if ( rt < 0 && errno == EINTR )
+      continue;
+
+    if ( rt != (int)sizeof( reply_ ) )
+      return false;
+
+    if ( reply_.magic == PSPMD_CTL_MAGIC && reply_.seq == seq_ )
+      return true;
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,181 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdGeometry
+//-----------------------------------------------------------------------------
+PspMdGeometry::PspMdGeometry()
+  : m_base( NULL ),
+    m_rowBase( NULL ),
+    m_otherBase( NULL ),
+    m_otherRowBase( NULL ),
+    m_colOffset( NULL ),
+    m_colX( NULL ),
+    m_rowY( NULL ),
+    m_xToCol( NULL ),
+    m_yToRow( NULL ),
+    m_lineLength( 0 ),
+    m_bytesPerPixel( 0 ),
+    m_width( 0 ),
+    m_height( 0 ),
+    m_cols( 0 ),
+    m_rows( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdGeometry::~PspMdGeometry()
+{
+  release();
+}
+//-----------------------------------------------------------------------------
+bool PspMdGeometry::Build
+(
+  unsigned int * base_,
+  int lineLength_,
+  int bytesPerPixel_,
+  int width_,
+  int height_,
+  int cols_,
+  int rows_,
+  int cellWidth_,
+  int cellHeight_
+)
+{
+  // A cell size of 0 asks for an exact partition of the screen
+  if ( cols_ <= 0 || rows_ <= 0 ||
+       cols_ > width_ || rows_ > height_ ||
+       cellWidth_ < 0 || cellHeight_ < 0 ||
+       cols_ * cellWidth_ > width_ || rows_ * cellHeight_ > height_ )
+  {
+    DBG(( DBG_PREFIX "Invalid console geometry %dx%d of %dx%d cells\n",
+          cols_, rows_, cellWidth_, cellHeight_ ));
+    return false;
+  }
+
+  release();
+
+  PspMdArena::Scope scope( PspMdArena::TAG_GEOMETRY );
+  m_rowBase      = new unsigned char *[ rows_ ];
+  m_otherRowBase = new unsigned char *[ rows_ ];
+  m_colOffset    = new int[ cols_ ];
+  m_colX         = new int[ cols_ + 1 ];
+  m_rowY         = new int[ rows_ + 1 ];
+  m_xToCol       = new unsigned short[ width_ ];
+  m_yToRow       = new unsigned short[ height_ ];
+  if ( m_rowBase == NULL || m_otherRowBase == NULL || m_colOffset == NULL ||
+       m_colX == NULL || m_rowY == NULL ||
+       m_xToCol == NULL || m_yToRow == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to allocate geometry tables\n" ));
+    release();
+    return false;
+  }
+
+  m_lineLength    = lineLength_;
+  m_bytesPerPixel = bytesPerPixel_;
+  m_width         = width_;
+  m_height        = height_;
+  m_cols          = cols_;
+  m_rows          = rows_;
+
+  buildEdges( m_colX, m_cols, m_width, cellWidth_ );
+  buildEdges( m_rowY, m_rows, m_height, cellHeight_ );
+  buildLookup( m_xToCol, m_colX, m_cols, m_width );
+  buildLookup( m_yToRow, m_rowY, m_rows, m_height );
+
+  for ( int i = 0; i < m_cols; i++ )
+    m_colOffset[ i ] = m_colX[ i ] * m_bytesPerPixel;
+
+  Rebase( base_ );
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdGeometry::Rebase(unsigned int * base_, unsigned int * otherBase_)
+{
+  m_base = (unsigned char *)base_;
+  m_otherBase = (unsigned char *)otherBase_;
+
+  if ( m_rowBase == NULL )
+    return;
+
+  for ( int i = 0; i < m_rows; i++ )
+    m_rowBase[ i ] = m_base + m_rowY[ i ] * m_lineLength;
+
+  if ( m_otherBase == NULL )
+    return;
+
+  for ( int i = 0; i < m_rows; i++ )
+    m_otherRowBase[ i ] = m_otherBase + m_rowY[ i ] * m_lineLength;
+}
+//-----------------------------------------------------------------------------
+void PspMdGeometry::Flip()
+{
+  unsigned char * base = m_base;
+  m_base = m_otherBase;
+  m_otherBase = base;
+
+  unsigned char ** rowBase = m_rowBase;
+  m_rowBase = m_otherRowBase;
+  m_otherRowBase = rowBase;
+}
+//-----------------------------------------------------------------------------
+void PspMdGeometry::buildEdges(int * edges_, int cells_, int pixels_, int size_)
+{
+  for ( int i = 0; i <= cells_; i++ )
+  {
+    if ( size_ > 0 )
+      edges_[ i ] = i * size_;
+    else
+      edges_[ i ] = i * pixels_ / cells_;
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMdGeometry::buildLookup
+(
+  unsigned short * lookup_,
+  const int * edges_,
+  int cells_,
+  int pixels_
+)
+{
+  // Pixels past the last edge, i.e. the font margin, go to the last cell
+  int cell = 0;
+  for ( int i = 0; i < pixels_; i++ )
+  {
+    while ( cell < cells_ - 1 && i >= edges_[ cell + 1 ] )
+      cell++;
+    lookup_[ i ] = (unsigned short)cell;
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMdGeometry::release()
+{
+  delete[] m_rowBase;
+  delete[] m_otherRowBase;
+  delete[] m_colOffset;
+  delete[] m_colX;
+  delete[] m_rowY;
+  delete[] m_xToCol;
+  delete[] m_yToRow;
+
+  m_rowBase      = NULL;
+  m_otherRowBase = NULL;
+  m_colOffset    = NULL;
+  m_colX         = NULL;
+  m_rowY         = NULL;
+  m_xToCol       = NULL;
+  m_yToRow       = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
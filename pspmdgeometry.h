@@ -0,0 +1,107 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDGEOMETRY_H
+#define PSPMDGEOMETRY_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdGeometry
+//
+// Maps console cells to VRAM and screen pixels to console cells. Everything
+// is precomputed into tables when the geometry is built, so the draw paths
+// do one lookup per cell and the pointer path does one lookup per axis,
+// without any multiply or divide. Rows are addressed with the scanline
+// length reported by the driver, which may be padded past the visible width.
+//
+// With page flipping the row table of the other page is kept alongside,
+// so a flip swaps the tables instead of rebuilding them.
+//
+// Cells are either of a fixed font size, anchored at the top left corner
+// with any margin folded into the last column and row, or, when the font
+// size is unknown, an exact partition of the screen whose cells differ by
+// at most one pixel.
+//-----------------------------------------------------------------------------
+class PspMdGeometry
+{
+public:
+  PspMdGeometry();
+  ~PspMdGeometry();
+
+  bool Build(unsigned int * base_,
+             int lineLength_,
+             int bytesPerPixel_,
+             int width_,
+             int height_,
+             int cols_,
+             int rows_,
+             int cellWidth_,
+             int cellHeight_);
+  void Rebase(unsigned int * base_, unsigned int * otherBase_ = NULL);
+  void Flip();
+
+  unsigned int * GetCell(int col_, int row_) const
+  {
+    return (unsigned int *)( m_rowBase[ row_ ] + m_colOffset[ col_ ] );
+  }
+
+  void ScreenToCell(int x_, int y_, int & col_, int & row_) const
+  {
+    col_ = m_xToCol[ x_ ];
+    row_ = m_yToRow[ y_ ];
+  }
+
+  int GetCols() const             { return m_cols; }
+  int GetRows() const             { return m_rows; }
+  int GetCellX(int col_) const    { return m_colX[ col_ ]; }
+  int GetCellY(int row_) const    { return m_rowY[ row_ ]; }
+  int GetCellWidth(int col_) const
+  {
+    return m_colX[ col_ + 1 ] - m_colX[ col_ ];
+  }
+  int GetCellHeight(int row_) const
+  {
+    return m_rowY[ row_ + 1 ] - m_rowY[ row_ ];
+  }
+  int GetLineLength() const       { return m_lineLength; }
+  const void * GetBase() const    { return m_base; }
+
+protected:
+  static void buildEdges(int * edges_, int cells_, int pixels_, int size_);
+  static void buildLookup(unsigned short * lookup_,
+                          const int * edges_,
+                          int cells_,
+                          int pixels_);
+  void release();
+
+  unsigned char *   m_base;
+  unsigned char **  m_rowBase;      // VRAM address of each console row
+  unsigned char *   m_otherBase;    // Same for the other page, if any
+  unsigned char **  m_otherRowBase;
+  int *             m_colOffset;    // Byte offset of each console column
+  int *             m_colX;         // Pixel edges of the columns, cols + 1
+  int *             m_rowY;         // Pixel edges of the rows, rows + 1
+  unsigned short *  m_xToCol;       // Console column of each pixel column
+  unsigned short *  m_yToRow;       // Console row of each pixel row
+  int               m_lineLength;
+  int               m_bytesPerPixel;
+  int               m_width;
+  int               m_height;
+  int               m_cols;
+  int               m_rows;
+
+private:
+  // Not implemented
+  PspMdGeometry(const PspMdGeometry &);
+  PspMdGeometry & operator = (const PspMdGeometry &);
+};
+
+
+#endif  // PSPMDGEOMETRY_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
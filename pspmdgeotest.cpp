@@ -0,0 +1,216 @@
+/*-----------------------------------------------------------------------------
+ * Geometry check for the PSP Mouse Daemon
+ * Renders every cell through PspMdGeometry into a padded buffer on the
+ * development host and checks that no byte outside the visible window moves
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const unsigned char c_canary       = 0xa5;   // Padding and guards
+static const int c_guardSize              = 64;     // Bytes past the buffer
+static const int c_maxPadding             = 33;     // Strides up to odd 33
+static const int c_maxBytesPerPixel       = 4;
+
+struct psp_md_geo_case_t
+{
+  int width;
+  int height;
+  int cols;
+  int rows;
+  int cellWidth;                // 0 = exact partition of the screen
+  int cellHeight;
+};
+
+static const psp_md_geo_case_t c_cases[] =
+{
+  { 480, 272, 80, 34,  6,  8 },   // PSP console, 6x8 font
+  { 480, 272, 60, 34,  8,  8 },
+  { 480, 272, 53, 17,  0,  0 },   // Odd partitions
+  { 481, 273, 80, 34,  6,  8 },   // Odd window, margin past the cells
+  {  37,  19,  7,  5,  0,  0 },
+  {  37,  19,  6,  3,  6,  6 },
+  {   1,   1,  1,  1,  0,  0 }
+};
+
+
+//-----------------------------------------------------------------------------
+// Prototypes
+//-----------------------------------------------------------------------------
+static bool checkCase(const psp_md_geo_case_t & case_,
+                      int bytesPerPixel_,
+                      int lineLength_);
+static void render(const PspMdGeometry & geometry_, int bytesPerPixel_);
+
+
+//-----------------------------------------------------------------------------
+// Implementations
+//-----------------------------------------------------------------------------
+int main()
+{
+  // Every odd and even stride past the visible width, at every depth
+  int checked = 0;
+  int failed = 0;
+
+  for ( unsigned int i = 0; i < sizeof( c_cases ) / sizeof( c_cases[ 0 ] );
+        i++ )
+  {
+    for ( int bpp = 1; bpp <= c_maxBytesPerPixel; bpp++ )
+    {
+      for ( int pad = 0; pad <= c_maxPadding; pad++ )
+      {
+        if ( !checkCase( c_cases[ i ], bpp, c_cases[ i ].width * bpp + pad ) )
+          failed++;
+
+        checked++;
+      }
+    }
+  }
+
+  printf( "%d layouts checked, %d failed\n", checked, failed );
+  return ( failed == 0 ) ? 0 : -1;
+}
+//-----------------------------------------------------------------------------
+static bool checkCase
+(
+  const psp_md_geo_case_t & case_,
+  int bytesPerPixel_,
+  int lineLength_
+)
+{
+  const int size = lineLength_ * case_.height;
+  unsigned char * buf = (unsigned char *)malloc( size + c_guardSize );
+  if ( buf == NULL )
+  {
+    fprintf( stderr, "Out of memory\n" );
+    return false;
+  }
+
+  // Visible bytes start cleared, the padding and the guard carry a canary
+  memset( buf, c_canary, size + c_guardSize );
+  for ( int y = 0; y < case_.height; y++ )
+    memset( buf + y * lineLength_, 0, case_.width * bytesPerPixel_ );
+
+  PspMdGeometry geometry;
+  bool ok = geometry.Build( (unsigned int *)buf,
+                            lineLength_,
+                            bytesPerPixel_,
+                            case_.width,
+                            case_.height,
+                            case_.cols,
+                            case_.rows,
+                            case_.cellWidth,
+                            case_.cellHeight );
+  // The tables are only there once the build succeeded
+  int cellsWidth = 0;
+  int cellsHeight = 0;
+  if ( ok )
+  {
+    render( geometry, bytesPerPixel_ );
+
+    // Each visible byte belongs to at most one cell, so it flips at most
+    // once and stays 0 only in the margin past the last cell
+    cellsWidth = geometry.GetCellX( case_.cols - 1 ) +
+                 geometry.GetCellWidth( case_.cols - 1 );
+    cellsHeight = geometry.GetCellY( case_.rows - 1 ) +
+                  geometry.GetCellHeight( case_.rows - 1 );
+  }
+
+  for ( int y = 0; ok && y < case_.height; y++ )
+  {
+    const unsigned char * line = buf + y * lineLength_;
+    for ( int x = 0; ok && x < lineLength_; x++ )
+    {
+      const int pixel = x / bytesPerPixel_;
+      unsigned char expected;
+      if ( pixel >= case_.width )
+        expected = c_canary;
+      else if ( pixel < cellsWidth && y < cellsHeight )
+        expected = 0xff;
+      else
+        expected = 0;
+
+      ok = ( line[ x ] == expected );
+    }
+  }
+
+  for ( int i = 0; ok && i < c_guardSize; i++ )
+    ok = ( buf[ size + i ] == c_canary );
+
+  // Every pixel maps back to the cell that covers it
+  for ( int x = 0; ok && x < case_.width; x++ )
+  {
+    int col, row;
+    geometry.ScreenToCell( x, 0, col, row );
+    ok = ( col < case_.cols &&
+           x >= geometry.GetCellX( col ) &&
+           ( x < geometry.GetCellX( col ) + geometry.GetCellWidth( col ) ||
+             col == case_.cols - 1 ) );
+  }
+
+  for ( int y = 0; ok && y < case_.height; y++ )
+  {
+    int col, row;
+    geometry.ScreenToCell( 0, y, col, row );
+    ok = ( row < case_.rows &&
+           y >= geometry.GetCellY( row ) &&
+           ( y < geometry.GetCellY( row ) + geometry.GetCellHeight( row ) ||
+             row == case_.rows - 1 ) );
+  }
+
+  if ( !ok )
+  {
+    fprintf( stderr, "%dx%d %dbpp stride %d, %dx%d cells of %dx%d: failed\n",
+             case_.width, case_.height, bytesPerPixel_ * 8, lineLength_,
+             case_.cols, case_.rows, case_.cellWidth, case_.cellHeight );
+  }
+
+  free( buf );
+  return ok;
+}
+//-----------------------------------------------------------------------------
+static void render(const PspMdGeometry & geometry_, int bytesPerPixel_)
+{
+  for ( int row = 0; row < geometry_.GetRows(); row++ )
+  {
+    for ( int col = 0; col < geometry_.GetCols(); col++ )
+    {
+      // The XOR renderer only runs at 32 bpp, through the daemon's own
+      // loop. Other depths are drawn bytewise to check the footprint the
+      // tables give the pointer and blend paths.
+      if ( bytesPerPixel_ == (int)sizeof( unsigned int ) )
+      {
+        PspMdScreen::XorRect( geometry_.GetCell( col, row ),
+                              geometry_.GetCellWidth( col ),
+                              geometry_.GetCellHeight( row ),
+                              geometry_.GetLineLength(),
+                              0xffffffff );
+        continue;
+      }
+
+      unsigned char * p = (unsigned char *)geometry_.GetCell( col, row );
+      const int bytes = geometry_.GetCellWidth( col ) * bytesPerPixel_;
+
+      for ( int i = 0; i < geometry_.GetCellHeight( row ); i++ )
+      {
+        for ( int j = 0; j < bytes; j++ )
+          p[ j ] ^= 0xff;
+
+        p += geometry_.GetLineLength();
+      }
+    }
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,357 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+static const int c_handoffTimeoutSec      = 2;  // Longest wait for the peer
+static const int c_setupTimeoutSec        = 10; // For the new one to set up
+static const char c_ackByte               = 1;
+static const char c_releaseByte           = 2;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdHandoff
+//-----------------------------------------------------------------------------
+PspMdHandoff::PspMdHandoff()
+  : m_listenFd( INVALID_FD ),
+    m_connFd( INVALID_FD )
+{
+  memset( &m_state, 0, sizeof( m_state ) );
+  for ( int i = 0; i < PSPMD_HANDOFF_FDS; i++ )
+    m_fds[ i ] = INVALID_FD;
+}
+//-----------------------------------------------------------------------------
+PspMdHandoff::~PspMdHandoff()
+{
+  // The socket file stays, the next instance binds over it
+  if ( m_listenFd >= 0 )
+  {
+    (void)close( m_listenFd );
+    m_listenFd = INVALID_FD;
+  }
+
+  Close();
+
+  for ( int i = 0; i < PSPMD_HANDOFF_FDS; i++ )
+  {
+    if ( m_fds[ i ] >= 0 )
+      (void)close( m_fds[ i ] );
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Listen(const char * fileName_)
+{
+  if ( m_listenFd >= 0 )
+  {
+    DBG(( DBG_PREFIX "PspMdHandoff has been initialized\n" ));
+    return true;
+  }
+
+  struct sockaddr_un address;
+  memset( &address, 0, sizeof( address ) );
+  if ( strlen( fileName_ ) >= sizeof( address.sun_path ) )
+  {
+    DBG(( DBG_PREFIX "Handoff socket name too long: %s\n", fileName_ ));
+    return false;
+  }
+
+  m_listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( m_listenFd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to create the handoff socket, err=%d\n",
+          errno ));
+    return false;
+  }
+
+  // The previous instance, if any, has exited by now
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, fileName_ );
+  (void)unlink( fileName_ );
+
+  if ( bind( m_listenFd, (struct sockaddr *)&address,
+             sizeof( address ) ) < 0 ||
+       listen( m_listenFd, 1 ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to listen on %s, err=%d\n",
+          fileName_, errno ));
+    (void)close( m_listenFd );
+    m_listenFd = INVALID_FD;
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Accept()
+{
+  m_connFd = accept( m_listenFd, NULL, NULL );
+  if ( m_connFd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to accept a handoff, err=%d\n", errno ));
+    return false;
+  }
+
+  return setTimeout( c_handoffTimeoutSec );
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Connect(const char * fileName_)
+{
+  struct sockaddr_un address;
+  memset( &address, 0, sizeof( address ) );
+  if ( strlen( fileName_ ) >= sizeof( address.sun_path ) )
+    return false;
+
+  m_connFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( m_connFd < 0 )
+    return false;
+
+  // Nobody listening is the plain start, not an error
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, fileName_ );
+  if ( connect( m_connFd, (struct sockaddr *)&address,
+                sizeof( address ) ) < 0 )
+  {
+    Close();
+    return false;
+  }
+
+  return setTimeout( c_handoffTimeoutSec );
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Send(const PspMdHandoffState & state_, const int * fds_)
+{
+  char control[ CMSG_SPACE( sizeof( int ) * PSPMD_HANDOFF_FDS ) ];
+  const int fdsSize = sizeof( int ) * state_.fdCount;
+
+  struct iovec iov;
+  iov.iov_base = (void *)&state_;
+  iov.iov_len = sizeof( state_ );
+
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE( fdsSize );
+
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( fdsSize );
+  memcpy( CMSG_DATA( cmsg ), fds_, fdsSize );
+
+  if ( sendmsg( m_connFd, &msg, 0 ) != (int)sizeof( state_ ) )
+  {
+    DBG(( DBG_PREFIX "Failed to hand off the devices, err=%d\n", errno ));
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Receive()
+{
+  char control[ CMSG_SPACE( sizeof( int ) * PSPMD_HANDOFF_FDS ) ];
+
+  struct iovec iov;
+  iov.iov_base = &m_state;
+  iov.iov_len = sizeof( m_state );
+
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+
+  const int rt = recvmsg( m_connFd, &msg, MSG_WAITALL );
+
+  // Whatever came attached is ours to close, even from a bad message
+  int count = 0;
+  for ( struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+        cmsg != NULL;
+        cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+  {
+    if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+      continue;
+
+    const int * fds = (const int *)CMSG_DATA( cmsg );
+    const int n = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+    for ( int i = 0; i < n; i++ )
+    {
+      if ( count < PSPMD_HANDOFF_FDS )
+        m_fds[ count++ ] = fds[ i ];
+      else
+        (void)close( fds[ i ] );
+    }
+  }
+
+  if ( rt != (int)sizeof( m_state ) ||
+       m_state.magic != PSPMD_HANDOFF_MAGIC ||
+       m_state.version != PSPMD_HANDOFF_VERSION ||
+       m_state.fdCount != count ||
+       m_state.deviceCount < 0 ||
+       m_state.deviceCount > PSPMD_HANDOFF_DEVICES )
+  {
+    DBG(( DBG_PREFIX "Dropped a malformed handoff of %d bytes\n", rt ));
+    m_state.fdCount = count;
+    return false;
+  }
+
+  // Sort the descriptors by kind, in place of the order they came in
+  int fds[ PSPMD_HANDOFF_FDS ];
+  memcpy( fds, m_fds, sizeof( fds ) );
+  for ( int i = 0; i < PSPMD_HANDOFF_FDS; i++ )
+    m_fds[ i ] = INVALID_FD;
+
+  for ( int i = 0; i < count; i++ )
+  {
+    const int kind = m_state.fdKinds[ i ];
+    if ( kind >= 0 && kind < PSPMD_HANDOFF_FDS && m_fds[ kind ] < 0 )
+      m_fds[ kind ] = fds[ i ];
+    else
+      (void)close( fds[ i ] );
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Write(const void * buf_, int size_)
+{
+  const char * p = (const char *)buf_;
+  while ( size_ > 0 )
+  {
+    const int rt = write( m_connFd, p, size_ );
+    if ( rt < 0 && errno == EINTR )
+      continue;
+
+    if ( rt <= 0 )
+    {
+      DBG(( DBG_PREFIX "Failed to write the handoff, err=%d\n", errno ));
+      return false;
+    }
+
+    p += rt;
+    size_ -= rt;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Read(void * buf_, int size_)
+{
+  char * p = (char *)buf_;
+  while ( size_ > 0 )
+  {
+    const int rt = read( m_connFd, p, size_ );
+    if ( rt < 0 && errno == EINTR )
+      continue;
+
+    if ( rt <= 0 )
+    {
+      DBG(( DBG_PREFIX "Failed to read the handoff, err=%d\n", errno ));
+      return false;
+    }
+
+    p += rt;
+    size_ -= rt;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Acknowledge()
+{
+  return Write( &c_ackByte, sizeof( c_ackByte ) );
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::WaitAcknowledge()
+{
+  // The new instance maps and builds everything before it answers
+  char ack = 0;
+  return setTimeout( c_setupTimeoutSec ) &&
+         Read( &ack, sizeof( ack ) ) && ack == c_ackByte;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::Release()
+{
+  return Write( &c_releaseByte, sizeof( c_releaseByte ) );
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::WaitRelease()
+{
+  // A close without the release byte means the old instance gave up on
+  // the handoff and runs on. After it, the end closes when it exits.
+  char release = 0;
+  if ( !Read( &release, sizeof( release ) ) || release != c_releaseByte )
+  {
+    Close();
+    return false;
+  }
+
+  char byte;
+  int rt;
+  do
+  {
+    rt = read( m_connFd, &byte, sizeof( byte ) );
+  } while ( rt < 0 && errno == EINTR );
+
+  Close();
+  return rt == 0;
+}
+//-----------------------------------------------------------------------------
+void PspMdHandoff::Close()
+{
+  if ( m_connFd >= 0 )
+  {
+    (void)close( m_connFd );
+    m_connFd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+int PspMdHandoff::TakeFd(int kind_)
+{
+  if ( kind_ < 0 || kind_ >= PSPMD_HANDOFF_FDS )
+    return INVALID_FD;
+
+  const int fd = m_fds[ kind_ ];
+  m_fds[ kind_ ] = INVALID_FD;
+  return fd;
+}
+//-----------------------------------------------------------------------------
+bool PspMdHandoff::setTimeout(int sec_)
+{
+  // Either side giving up halfway must not hang the other
+  struct timeval tv;
+  tv.tv_sec = sec_;
+  tv.tv_usec = 0;
+
+  if ( setsockopt( m_connFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) ) < 0 ||
+       setsockopt( m_connFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to set the handoff timeout, err=%d\n", errno ));
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
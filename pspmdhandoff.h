@@ -0,0 +1,129 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDHANDOFF_H
+#define PSPMDHANDOFF_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+//-----------------------------------------------------------------------------
+// Handoff protocol
+//
+// A new instance connects to the socket of the running one, which answers
+// between two input batches: it takes its overlay off the screen, then
+// sends a PspMdHandoffState with the open devices attached as SCM_RIGHTS,
+// followed by recordsSize bytes of its flight recorder and clipboardSize
+// bytes of clipboard. The new instance sets itself up on the devices it
+// got and acknowledges with one byte once only the sockets and shared
+// files the old one holds are left to open. The old one answers with a
+// release byte and exits; its end of the connection closes last, so end of
+// file after that byte tells the new instance the files are free. Should
+// the connection close without it, the old instance has kept running on
+// its descriptors and the new one gives up.
+//
+// Packets that arrive in between wait in the devices, and a packet split
+// across reads goes over with the device, so none is lost. The control
+// socket goes over the same way with the batches queued in it.
+//-----------------------------------------------------------------------------
+#define PSPMD_HANDOFF_MAGIC     0x48444d50    // "PMDH"
+#define PSPMD_HANDOFF_VERSION   2
+#define PSPMD_HANDOFF_DEVICES   4             // PspMdOptions::MAX_MICE
+#define PSPMD_HANDOFF_FDS       ( 4 + PSPMD_HANDOFF_DEVICES )
+
+enum
+{
+  PSPMD_HANDOFF_FD_VCS = 0,
+  PSPMD_HANDOFF_FD_VCSU,
+  PSPMD_HANDOFF_FD_FB,
+  PSPMD_HANDOFF_FD_CONTROL,
+  PSPMD_HANDOFF_FD_MOUSE                      // Plus the device index
+};
+
+struct PspMdHandoffDevice
+{
+  char            partial[ 4 ];   // Bytes of a packet split across reads
+  int             partialSize;
+  unsigned int    buttons;
+  int             carryX;
+  int             carryY;
+};
+
+struct PspMdHandoffState
+{
+  unsigned int    magic;
+  unsigned int    version;
+  int             pid;            // Instance handing off
+  int             fdCount;
+  int             fdKinds[ PSPMD_HANDOFF_FDS ];   // PSPMD_HANDOFF_FD_*
+  int             deviceCount;
+  PspMdHandoffDevice devices[ PSPMD_HANDOFF_DEVICES ];
+  int             x;              // Pointer position
+  int             y;
+  unsigned int    buttons;        // Buttons of the last event
+  int             selFrom;        // Selection in screen cells, from > to
+  int             selTo;          // when there is none
+  int             selBlock;
+  unsigned int    packetsRead;    // Packets the old instance has read
+  unsigned int    recNextSeq;     // Flight recorder position and clock
+  long            recStartSec;
+  int             recordsSize;
+  int             clipboardSize;
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdHandoff
+//
+// Both ends of the handoff socket. The running instance listens and
+// answers one connection with Send(); the new one connects, Receive()s and
+// keeps the descriptors until the devices take them with TakeFd().
+//-----------------------------------------------------------------------------
+class PspMdHandoff
+{
+public:
+  PspMdHandoff();
+  ~PspMdHandoff();
+
+  bool Listen(const char * fileName_);
+  bool Accept();
+  bool Connect(const char * fileName_);
+  bool Send(const PspMdHandoffState & state_, const int * fds_);
+  bool Receive();
+  bool Write(const void * buf_, int size_);
+  bool Read(void * buf_, int size_);
+  bool Acknowledge();
+  bool WaitAcknowledge();
+  bool Release();
+  bool WaitRelease();
+  void Close();
+  int TakeFd(int kind_);
+
+  bool IsListening() const                      { return m_listenFd >= 0; }
+  int GetFd() const                             { return m_listenFd; }
+  const PspMdHandoffState & GetState() const    { return m_state; }
+
+protected:
+  bool setTimeout(int sec_);
+
+  int m_listenFd;
+  int m_connFd;
+  PspMdHandoffState m_state;    // Received from the old instance
+  int m_fds[ PSPMD_HANDOFF_FDS ];
+
+private:
+  // Not implemented
+  PspMdHandoff(const PspMdHandoff &);
+  PspMdHandoff & operator = (const PspMdHandoff &);
+};
+
+
+#endif  // PSPMDHANDOFF_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,102 @@
+#!/bin/sh
+#------------------------------------------------------------------------------
+# Handoff check for the PSP Mouse Daemon
+#
+# On the target, "run" starts a daemon with -u -c and feeds numbered batches
+# of motion through the control socket with pspmdctl. A second instance
+# takes over halfway, and the flight recorder of the survivor is dumped to
+# pspmd.rec. On the development host, "verify" decodes that dump with
+# pspmdrec and diffs the served batches against the ones sent: each must
+# show up once, in order, with every event processed, and the takeover must
+# fall between two of them.
+#
+#   target$ ./pspmdhandoff.sh run [batches] [events]
+#   host$   ./pspmdhandoff.sh verify pspmd.rec [batches] [events]
+#
+# The recorder keeps 256 records, the default 64 batches leave room for the
+# rest of both runs.
+#------------------------------------------------------------------------------
+PSPMD=${PSPMD:-pspmd}
+PSPMDCTL=${PSPMDCTL:-pspmdctl}
+PSPMDREC=${PSPMDREC:-./pspmdrec}
+REC_FILE=/tmp/pspmd.rec
+BATCH_MSEC=50
+SETTLE_SEC=2
+
+fail()
+{
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+run()
+{
+  batches=${1:-64}
+  events=${2:-32}
+
+  $PSPMD -u -c &
+  old=$!
+  sleep $SETTLE_SEC
+
+  # About a third of the batches go to the first instance
+  $PSPMDCTL $batches $events $BATCH_MSEC > pspmdctl.out &
+  feed=$!
+  sleep $(( batches * BATCH_MSEC / 3000 + 1 ))
+
+  $PSPMD -u -c &
+  new=$!
+
+  wait $feed || fail "a batch was lost or cut short, see pspmdctl.out"
+  wait $old
+
+  kill -USR1 $new
+  sleep 1
+  kill $new
+  cp $REC_FILE pspmd.rec || fail "no recorder dump"
+  echo "Sent $batches batches, decode pspmd.rec with: $0 verify pspmd.rec" \
+       "$batches $events"
+}
+
+verify()
+{
+  dump=$1
+  batches=${2:-64}
+  events=${3:-32}
+  [ -n "$dump" ] || fail "no dump given"
+
+  $PSPMDREC "$dump" > pspmd.rec.txt || fail "cannot decode $dump"
+
+  i=1
+  while [ $i -le $batches ]; do
+    echo "$i $events $events"
+    i=$(( i + 1 ))
+  done > pspmd.expected
+
+  awk '$3 == "EVT_CONTROL" { print $4, $5, $6 }' pspmd.rec.txt \
+    > pspmd.served
+  diff pspmd.expected pspmd.served || fail "served batches differ"
+
+  # The takeover has to land mid-stream for the check to mean anything
+  awk '$3 == "EVT_CONTROL" { served++ }
+       $3 == "EVT_TAKEOVER" { before = served }
+       END { exit !( before > 0 && before < served ) }' pspmd.rec.txt \
+    || fail "no takeover between two batches"
+
+  echo "OK: $batches batches of $events events served once across the handoff"
+}
+
+case "$1" in
+run)
+  shift
+  run "$@"
+  ;;
+verify)
+  shift
+  verify "$@"
+  ;;
+*)
+  echo "Usage: $0 run [batches] [events]"
+  echo "       $0 verify <dump> [batches] [events]"
+  exit 1
+  ;;
+esac
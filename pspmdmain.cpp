@@ -5,6 +5,13 @@
 #include "pspmd.h"
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int c_maxPercent             = 1000;
 
 
 //-----------------------------------------------------------------------------
@@ -12,6 +19,7 @@
 //-----------------------------------------------------------------------------
 static void showVersion();
 static void showHelp();
+static bool parseOptions(int argc_, char * argv_[], PspMdOptions & options_);
 
 
 //-----------------------------------------------------------------------------
@@ -30,14 +38,25 @@ int main(int argc_, char * argv_[])
     return 0;
   }
 
+  PspMdOptions options;
+  if ( !parseOptions( argc_, argv_, options ) )
+  {
+    showHelp();
+    return -1;
+  }
+
   PspMouseDaemon dm;
 
-  if ( !dm.Initialize() )
+  if ( !dm.Initialize( options ) )
   {
+    (void)dm.GetRecorder().Dump();
     DBG(( DBG_PREFIX "Failed to launch the daemon because of a previous error\n" ));
     return -1;
   }
 
+  if ( options.benchPasses > 0 )
+    return dm.Benchmark() ? 0 : -1;
+
   // Then just run it!
   (void)dm.Run();
 
@@ -55,7 +74,158 @@ static void showHelp()
   printf( "Usage: pspmd [options]\n"
           "  --help     Show this help\n"
           "  --version  Show version info\n"
-          "  -s         Silent mode\n" );
+          "  -s         Silent mode\n"
+          "  -r <prio>  Low latency mode: SCHED_FIFO at <prio>, locked memory\n"
+          "             and prefaulted framebuffer\n"
+          "  -f <W>x<H> Console font size in pixels, detected by default\n"
+          "  -d         Double buffered rendering with page flipping\n"
+          "  -p         Pixel accurate arrow pointer instead of the cell cursor\n"
+          "  -a <alpha> Alpha blended highlight, <alpha> from 1 to 255. Below\n"
+          "             32bpp the cursor needs -p or the attr renderer\n"
+          "  -t <name>  Cursor and highlight renderer: xor in the framebuffer,\n"
+          "             attr through /dev/vcsa, or auto for the cheaper one\n"
+          "             on the current mode (default)\n"
+          "  -m         Highlight the other occurrences of the selected text\n"
+          "  -z <sec>   Hide the cursor after <sec> seconds without input\n"
+          "  -e         Serve mouse events to console applications through\n"
+          "             xterm reports and the shared ring /tmp/pspmd.ring\n"
+          "  -c         Accept synthetic input batches on /tmp/pspmd.ctl\n"
+          "  -k         Keep the pointer, selection and clipboard in\n"
+          "             /tmp/pspmd.state, and clean up after an instance\n"
+          "             that died\n"
+          "  -u         Upgrade without downtime: take the devices and the\n"
+          "             state over from an instance running with -u, and\n"
+          "             hand them on to the next one through\n"
+          "             /tmp/pspmd.handoff\n"
+          "  -x <speed>,<accel>,<threshold>\n"
+          "             Pointer acceleration: a packet moves <speed> percent of\n"
+          "             its counts, and the counts beyond <threshold> <accel>\n"
+          "             percent of that, 100,100,0 by default\n"
+          "  -i <dev>   Input device, repeat to merge up to 4 of them into\n"
+          "             the pointer, /dev/mouse by default\n"
+          "  -M <kb>    Carve every buffer from one region of <kb> KB reserved\n"
+          "             at startup, 0 sizes it from the console, and never\n"
+          "             touch the heap again\n"
+          "  -F         Print the memory footprint of every subsystem\n"
+          "  -b <n>     Time <n> passes of the highlight renderers and exit\n" );
+}
+//-----------------------------------------------------------------------------
+static bool parseOptions(int argc_, char * argv_[], PspMdOptions & options_)
+{
+  for ( int i = 1; i < argc_; i++ )
+  {
+    if ( strcmp( argv_[ i ], "-s" ) == 0 )
+    {
+      // Silent is the default now that debug output goes to the recorder
+    }
+    else if ( strcmp( argv_[ i ], "-r" ) == 0 && i + 1 < argc_ )
+    {
+      options_.lowLatency = true;
+      options_.rtPriority = atoi( argv_[ ++i ] );
+    }
+    else if ( strcmp( argv_[ i ], "-d" ) == 0 )
+    {
+      options_.doubleBuffer = true;
+    }
+    else if ( strcmp( argv_[ i ], "-p" ) == 0 )
+    {
+      options_.pointer = true;
+    }
+    else if ( strcmp( argv_[ i ], "-e" ) == 0 )
+    {
+      options_.service = true;
+    }
+    else if ( strcmp( argv_[ i ], "-t" ) == 0 && i + 1 < argc_ )
+    {
+      const char * name = argv_[ ++i ];
+      if ( strcmp( name, "auto" ) == 0 )
+        options_.renderer = PspMdOptions::RENDERER_AUTO;
+      else if ( strcmp( name, "xor" ) == 0 )
+        options_.renderer = PspMdOptions::RENDERER_XOR;
+      else if ( strcmp( name, "attr" ) == 0 )
+        options_.renderer = PspMdOptions::RENDERER_ATTR;
+      else
+        return false;
+    }
+    else if ( strcmp( argv_[ i ], "-x" ) == 0 && i + 1 < argc_ )
+    {
+      if ( sscanf( argv_[ ++i ], "%d,%d,%d",
+                   &options_.accelSpeed, &options_.accelFactor,
+                   &options_.accelThreshold ) != 3 ||
+           options_.accelSpeed <= 0 || options_.accelSpeed > c_maxPercent ||
+           options_.accelFactor <= 0 || options_.accelFactor > c_maxPercent ||
+           options_.accelThreshold < 0 )
+      {
+        return false;
+      }
+    }
+    else if ( strcmp( argv_[ i ], "-i" ) == 0 && i + 1 < argc_ )
+    {
+      if ( options_.mouseCount == PspMdOptions::MAX_MICE )
+        return false;
+
+      options_.mice[ options_.mouseCount++ ] = argv_[ ++i ];
+    }
+    else if ( strcmp( argv_[ i ], "-c" ) == 0 )
+    {
+      options_.control = true;
+    }
+    else if ( strcmp( argv_[ i ], "-k" ) == 0 )
+    {
+      options_.persist = true;
+    }
+    else if ( strcmp( argv_[ i ], "-u" ) == 0 )
+    {
+      options_.handoff = true;
+    }
+    else if ( strcmp( argv_[ i ], "-z" ) == 0 && i + 1 < argc_ )
+    {
+      options_.idleSec = atoi( argv_[ ++i ] );
+      if ( options_.idleSec <= 0 )
+        return false;
+    }
+    else if ( strcmp( argv_[ i ], "-m" ) == 0 )
+    {
+      options_.matches = true;
+    }
+    else if ( strcmp( argv_[ i ], "-a" ) == 0 && i + 1 < argc_ )
+    {
+      options_.alpha = atoi( argv_[ ++i ] );
+      if ( options_.alpha <= 0 || options_.alpha > 255 )
+        return false;
+    }
+    else if ( strcmp( argv_[ i ], "-M" ) == 0 && i + 1 < argc_ )
+    {
+      options_.arenaKb = atoi( argv_[ ++i ] );
+      if ( options_.arenaKb < 0 )
+        return false;
+    }
+    else if ( strcmp( argv_[ i ], "-F" ) == 0 )
+    {
+      options_.footprint = true;
+    }
+    else if ( strcmp( argv_[ i ], "-b" ) == 0 && i + 1 < argc_ )
+    {
+      options_.benchPasses = atoi( argv_[ ++i ] );
+      if ( options_.benchPasses <= 0 )
+        return false;
+    }
+    else if ( strcmp( argv_[ i ], "-f" ) == 0 && i + 1 < argc_ )
+    {
+      if ( sscanf( argv_[ ++i ], "%dx%d",
+                   &options_.fontWidth, &options_.fontHeight ) != 2 ||
+           options_.fontWidth <= 0 || options_.fontHeight <= 0 )
+      {
+        return false;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return true;
 }
 
 
@@ -0,0 +1,273 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+static const int c_marksSize              = PSPMD_STATE_CELLS / 8;
+static const int c_stateSize              = sizeof( PspMdStateHeader ) +
+                                            c_marksSize * 2 +
+                                            PSPMD_STATE_CELLS +
+                                            PSPMD_STATE_CLIPBOARD;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdPersist
+//-----------------------------------------------------------------------------
+PspMdPersist::PspMdPersist()
+  : m_header( NULL ),
+    m_marks( NULL ),
+    m_swapped( NULL ),
+    m_written( NULL ),
+    m_clipboard( NULL ),
+    m_fd( INVALID_FD ),
+    m_cells( 0 ),
+    m_restored( false )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdPersist::~PspMdPersist()
+{
+  if ( m_header != NULL )
+  {
+    // The state stays for the next instance, only the owner goes. One that
+    // handed off has passed the segment on already.
+    if ( m_header->pid == getpid() )
+      m_header->pid = 0;
+    (void)munmap( (void *)m_header, c_stateSize );
+    m_header = NULL;
+    m_marks = NULL;
+    m_swapped = NULL;
+    m_written = NULL;
+    m_clipboard = NULL;
+  }
+
+  if ( m_fd >= 0 )
+  {
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdPersist::Initialize(const char * fileName_, int handoffPid_)
+{
+  if ( m_header != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdPersist has been initialized\n" ));
+    return true;
+  }
+
+  m_fd = open( fileName_, O_RDWR | O_CREAT, 0644 );
+  if ( m_fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to open state segment %s, err=%d\n",
+          fileName_, errno ));
+    return false;
+  }
+
+  // A segment of another size is from another build and starts over
+  struct stat st;
+  const bool existing = fstat( m_fd, &st ) == 0 && st.st_size == c_stateSize;
+
+  void * addr = MAP_FAILED;
+  if ( existing || ftruncate( m_fd, c_stateSize ) == 0 )
+  {
+    addr = mmap( NULL, c_stateSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 m_fd, 0 );
+  }
+
+  if ( addr == MAP_FAILED )
+  {
+    DBG(( DBG_PREFIX "Failed to map state segment %s, err=%d\n",
+          fileName_, errno ));
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+    return false;
+  }
+
+  PspMdStateHeader * header = (PspMdStateHeader *)addr;
+  m_restored = existing &&
+               header->magic == PSPMD_STATE_MAGIC &&
+               header->version == PSPMD_STATE_VERSION;
+
+  // Two daemons drawing on one console would undo each other. The one
+  // handing off waits for this one and exits.
+  if ( m_restored && header->pid != 0 && header->pid != getpid() &&
+       header->pid != handoffPid_ &&
+       ( kill( header->pid, 0 ) == 0 || errno != ESRCH ) )
+  {
+    DBG(( DBG_PREFIX "State segment %s is owned by %d\n",
+          fileName_, header->pid ));
+    (void)munmap( addr, c_stateSize );
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+    m_restored = false;
+    return false;
+  }
+
+  if ( !m_restored )
+  {
+    memset( addr, 0, c_stateSize );
+    header->selTo = -1;
+    header->version = PSPMD_STATE_VERSION;
+    header->magic = PSPMD_STATE_MAGIC;
+  }
+
+  header->pid = getpid();
+  m_header = header;
+  m_marks = (unsigned char *)addr + sizeof( PspMdStateHeader );
+  m_swapped = m_marks + c_marksSize;
+  m_written = m_swapped + c_marksSize;
+  m_clipboard = (char *)m_written + PSPMD_STATE_CELLS;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdPersist::SetLayout(const PspMdLayout & layout_)
+{
+  if ( m_header == NULL )
+    return;
+
+  const int cells = layout_.cols * layout_.rows;
+  m_cells = ( cells <= PSPMD_STATE_CELLS ) ? cells : 0;
+
+  if ( memcmp( &m_header->layout, &layout_, sizeof( layout_ ) ) == 0 )
+    return;
+
+  // Cells and timings of another layout mean nothing on this one
+  ClearMarks();
+  ClearSwapped();
+  m_header->layout = layout_;
+  m_header->renderer = 0;
+  SetSelection( 0, -1, false );
+}
+//-----------------------------------------------------------------------------
+int PspMdPersist::NextMark(int cell_) const
+{
+  return nextBit( m_marks, cell_, m_cells );
+}
+//-----------------------------------------------------------------------------
+void PspMdPersist::ClearMarks()
+{
+  if ( m_marks != NULL )
+    memset( m_marks, 0, c_marksSize );
+}
+//-----------------------------------------------------------------------------
+int PspMdPersist::NextSwapped(int cell_) const
+{
+  return nextBit( m_swapped, cell_, m_cells );
+}
+//-----------------------------------------------------------------------------
+void PspMdPersist::ClearSwapped()
+{
+  if ( m_swapped != NULL )
+    memset( m_swapped, 0, c_marksSize );
+}
+//-----------------------------------------------------------------------------
+void PspMdPersist::ScrollSwapped(int cells_)
+{
+  // Follows the attributes up with the text, as PspMdAttr::Scroll()
+  if ( cells_ <= 0 )
+    return;
+
+  for ( int cell = 0; cell < m_cells; cell++ )
+  {
+    const int from = cell + cells_;
+    if ( from < m_cells && ( m_swapped[ from >> 3 ] & ( 1 << ( from & 7 ) ) ) )
+      MarkSwapped( cell, m_written[ from ] );
+    else
+      UnmarkSwapped( cell );
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMdPersist::SaveClipboard(const PspMdClipboard & clipboard_)
+{
+  if ( m_header == NULL )
+    return;
+
+  // Empty while the text is replaced, a crash in between loses the copy
+  // rather than mixing two
+  m_header->clipboardSize = 0;
+
+  int size = 0;
+  for ( const PspMdClipboard::Chunk * chunk = clipboard_.GetFirst();
+        chunk != NULL && size < PSPMD_STATE_CLIPBOARD;
+        chunk = chunk->next )
+  {
+    int len = chunk->size;
+    if ( len > PSPMD_STATE_CLIPBOARD - size )
+      len = PSPMD_STATE_CLIPBOARD - size;
+
+    memcpy( m_clipboard + size, chunk->data, len );
+    size += len;
+  }
+
+  m_header->clipboardSize = size;
+}
+//-----------------------------------------------------------------------------
+bool PspMdPersist::RestoreClipboard(PspMdClipboard & clipboard_) const
+{
+  if ( m_header == NULL )
+    return false;
+
+  // A size the segment cannot hold comes from a corrupt state, it leaves
+  // the clipboard empty
+  clipboard_.Clear();
+  const int size = m_header->clipboardSize;
+  if ( size <= 0 || size > PSPMD_STATE_CLIPBOARD )
+    return true;
+
+  return clipboard_.Append( m_clipboard, size );
+}
+//-----------------------------------------------------------------------------
+bool PspMdPersist::GetSelection(int & from_, int & to_, bool & block_) const
+{
+  if ( m_header == NULL || m_header->selFrom > m_header->selTo )
+    return false;
+
+  from_ = m_header->selFrom;
+  to_ = m_header->selTo;
+  block_ = m_header->selBlock != 0;
+  return true;
+}
+//-----------------------------------------------------------------------------
+int PspMdPersist::GetMappedSize() const
+{
+  return ( m_header != NULL ) ? c_stateSize : 0;
+}
+//-----------------------------------------------------------------------------
+int PspMdPersist::nextBit(const unsigned char * bits_, int cell_, int cells_)
+{
+  while ( cell_ < cells_ )
+  {
+    const unsigned char bits = bits_[ cell_ >> 3 ];
+    if ( bits == 0 )
+      cell_ = ( cell_ | 7 ) + 1;
+    else if ( bits & ( 1 << ( cell_ & 7 ) ) )
+      return cell_;
+    else
+      cell_++;
+  }
+
+  return -1;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
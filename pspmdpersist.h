@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDPERSIST_H
+#define PSPMDPERSIST_H
+
+class PspMdClipboard;
+
+
+//-----------------------------------------------------------------------------
+// Persistent state layout
+//
+// The segment outlives the daemon, so an instance restarted after a crash
+// finds what the previous one left: the pointer, the selection, the last
+// copy, a bitmap of the cells it may have XORed and one of the cells whose
+// attribute it swapped, with the attribute it wrote there. The bitmaps and
+// the selection only hold for the layout recorded with them, and are
+// dropped when the layout changes. A copy longer than the segment keeps
+// its start.
+//-----------------------------------------------------------------------------
+#define PSPMD_STATE_MAGIC       0x53444d50    // "PMDS"
+#define PSPMD_STATE_VERSION     2
+#define PSPMD_STATE_CELLS       16384         // Largest console with a bitmap
+#define PSPMD_STATE_CLIPBOARD   32768         // Bytes of the last copy kept
+
+struct PspMdLayout
+{
+  int             width;      // Screen
+  int             height;
+  int             lineLength;
+  int             bytesPerPixel;
+  int             cols;       // Console
+  int             rows;
+  int             cellWidth;
+  int             cellHeight;
+};
+
+struct PspMdStateHeader
+{
+  unsigned int    magic;
+  unsigned int    version;
+  int             pid;        // Running owner, 0 after a clean exit
+  PspMdLayout     layout;
+  int             renderer;   // Renderer timed on this layout, 0 if none
+  int             x;          // Pointer position
+  int             y;
+  int             selFrom;    // Selection in screen cells, from > to when
+  int             selTo;      // there is none
+  int             selBlock;
+  int             clipboardSize;
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdPersist
+//
+// Owner side of the state segment. Everything is written in place as it
+// changes, so there is nothing to save on the way out and a crash loses at
+// most the event being handled. A cell is marked before it is XORed or its
+// attribute swapped and unmarked once clean, the bitmaps never miss a stale
+// cell.
+//-----------------------------------------------------------------------------
+class PspMdPersist
+{
+public:
+  PspMdPersist();
+  ~PspMdPersist();
+
+  bool Initialize(const char * fileName_, int handoffPid_ = 0);
+  void SetLayout(const PspMdLayout & layout_);
+  int NextMark(int cell_) const;
+  void ClearMarks();
+  int NextSwapped(int cell_) const;
+  void ClearSwapped();
+  void ScrollSwapped(int cells_);
+  void SaveClipboard(const PspMdClipboard & clipboard_);
+  bool RestoreClipboard(PspMdClipboard & clipboard_) const;
+  bool GetSelection(int & from_, int & to_, bool & block_) const;
+  int GetMappedSize() const;
+
+  bool IsEnabled() const    { return m_header != NULL; }
+  bool IsRestored() const   { return m_restored; }
+
+  void Mark(int cell_)
+  {
+    if ( cell_ < m_cells )
+      m_marks[ cell_ >> 3 ] |= (unsigned char)( 1 << ( cell_ & 7 ) );
+  }
+
+  void Unmark(int cell_)
+  {
+    if ( cell_ < m_cells )
+      m_marks[ cell_ >> 3 ] &= (unsigned char)~( 1 << ( cell_ & 7 ) );
+  }
+
+  void MarkSwapped(int cell_, unsigned char written_)
+  {
+    if ( cell_ < m_cells )
+    {
+      m_swapped[ cell_ >> 3 ] |= (unsigned char)( 1 << ( cell_ & 7 ) );
+      m_written[ cell_ ] = written_;
+    }
+  }
+
+  void UnmarkSwapped(int cell_)
+  {
+    if ( cell_ < m_cells )
+      m_swapped[ cell_ >> 3 ] &= (unsigned char)~( 1 << ( cell_ & 7 ) );
+  }
+
+  unsigned char GetWritten(int cell_) const  { return m_written[ cell_ ]; }
+
+  void SetPointer(int x_, int y_)
+  {
+    m_header->x = x_;
+    m_header->y = y_;
+  }
+
+  void GetPointer(int & x_, int & y_) const
+  {
+    x_ = m_header->x;
+    y_ = m_header->y;
+  }
+
+  void SetSelection(int from_, int to_, bool block_)
+  {
+    m_header->selFrom = from_;
+    m_header->selTo = to_;
+    m_header->selBlock = block_;
+  }
+
+  int GetRenderer() const   { return ( m_header != NULL ) ?
+                                     m_header->renderer : 0; }
+  void SetRenderer(int renderer_)
+  {
+    if ( m_header != NULL )
+      m_header->renderer = renderer_;
+  }
+
+protected:
+  static int nextBit(const unsigned char * bits_, int cell_, int cells_);
+
+  PspMdStateHeader *  m_header;
+  unsigned char *     m_marks;
+  unsigned char *     m_swapped;    // Cells with a swapped attribute
+  unsigned char *     m_written;    // Attribute written to each of them
+  char *              m_clipboard;
+  int                 m_fd;
+  int                 m_cells;      // Cells the bitmap covers, 0 when the
+                                    // console is too large for it
+  bool                m_restored;   // Found a segment of a previous run
+
+private:
+  // Not implemented
+  PspMdPersist(const PspMdPersist &);
+  PspMdPersist & operator = (const PspMdPersist &);
+};
+
+
+#endif  // PSPMDPERSIST_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
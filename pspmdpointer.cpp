@@ -0,0 +1,325 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int c_spriteWidth            = 10;
+static const int c_spriteHeight           = 16;
+
+// 'X' is the outline, '.' the fill, anything else is transparent
+static const char * const c_sprite[ c_spriteHeight ] =
+{
+  "X         ",
+  "XX        ",
+  "X.X       ",
+  "X..X      ",
+  "X...X     ",
+  "X....X    ",
+  "X.....X   ",
+  "X......X  ",
+  "X.......X ",
+  "X........X",
+  "X.....XXXX",
+  "X..X..X   ",
+  "X.X X..X  ",
+  "XX  X..X  ",
+  "X    X..X ",
+  "      XX  "
+};
+
+static const unsigned int c_outlineRgb    = 0x000000;
+static const unsigned int c_fillRgb       = 0xffffff;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdPointer
+//-----------------------------------------------------------------------------
+PspMdPointer::PspMdPointer(PspMdScreen & screen_)
+  : m_screen( screen_ ),
+    m_mask( NULL ),
+    m_color( NULL ),
+    m_saved( NULL ),
+    m_scratch( NULL ),
+    m_visible( false ),
+    m_x( 0 ),
+    m_y( 0 ),
+    m_width( 0 ),
+    m_height( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdPointer::~PspMdPointer()
+{
+  delete[] m_mask;
+  delete[] m_color;
+  delete[] m_saved;
+  delete[] m_scratch;
+}
+//-----------------------------------------------------------------------------
+bool PspMdPointer::Initialize()
+{
+  if ( m_mask != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdPointer has been initialized\n" ));
+    return true;
+  }
+
+  if ( m_screen.GetBytesPerPixel() != sizeof( unsigned int ) )
+  {
+    DBG(( DBG_PREFIX "Pointer sprite needs a 32bpp framebuffer\n" ));
+    return false;
+  }
+
+  PspMdArena::Scope scope( PspMdArena::TAG_POINTER );
+  const int size = c_spriteWidth * c_spriteHeight;
+  unsigned int * mask = new unsigned int[ size ];
+  m_color   = new unsigned int[ size ];
+  m_saved   = new unsigned int[ size ];
+  m_scratch = new unsigned int[ 4 * size ];
+  if ( mask == NULL || m_color == NULL || m_saved == NULL || m_scratch == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to allocate pointer buffers\n" ));
+    delete[] mask;
+    return false;
+  }
+
+  const unsigned int outline = m_screen.MakePixel( c_outlineRgb );
+  const unsigned int fill = m_screen.MakePixel( c_fillRgb );
+
+  for ( int i = 0; i < c_spriteHeight; i++ )
+  {
+    for ( int j = 0; j < c_spriteWidth; j++ )
+    {
+      const int k = i * c_spriteWidth + j;
+      switch ( c_sprite[ i ][ j ] )
+      {
+      case 'X':
+        mask[ k ] = 0;
+        m_color[ k ] = outline;
+        break;
+
+      case '.':
+        mask[ k ] = 0;
+        m_color[ k ] = fill;
+        break;
+
+      default:
+        mask[ k ] = 0xffffffff;
+        m_color[ k ] = 0;
+        break;
+      }
+    }
+  }
+
+  // Enabled from here on
+  m_mask = mask;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::Show(int x_, int y_)
+{
+  if ( m_mask == NULL || ( m_visible && x_ == m_x && y_ == m_y ) )
+    return;
+
+  int width, height;
+  clip( x_, y_, width, height );
+
+  if ( m_visible )
+  {
+    const int left   = ( m_x < x_ ) ? m_x : x_;
+    const int top    = ( m_y < y_ ) ? m_y : y_;
+    const int right  = ( m_x + m_width > x_ + width ) ?
+                       m_x + m_width : x_ + width;
+    const int bottom = ( m_y + m_height > y_ + height ) ?
+                       m_y + m_height : y_ + height;
+    const int unionWidth = right - left;
+    const int unionHeight = bottom - top;
+
+    if ( unionWidth <= 2 * c_spriteWidth && unionHeight <= 2 * c_spriteHeight )
+    {
+      // Restore, save and draw inside the union box, then write it back
+      unsigned int * oldPos = m_scratch +
+                              ( m_y - top ) * unionWidth + ( m_x - left );
+      unsigned int * newPos = m_scratch +
+                              ( y_ - top ) * unionWidth + ( x_ - left );
+
+      readRect( m_scratch, unionWidth, left, top, unionWidth, unionHeight );
+      copyRect( oldPos, unionWidth, m_saved, c_spriteWidth,
+                m_width, m_height );
+      copyRect( m_saved, c_spriteWidth, newPos, unionWidth, width, height );
+      blit( newPos, unionWidth, width, height );
+      writeRect( m_scratch, unionWidth, left, top, unionWidth, unionHeight );
+
+      m_screen.Damage( top, unionHeight );
+      m_x = x_;
+      m_y = y_;
+      m_width = width;
+      m_height = height;
+      return;
+    }
+
+    Hide();
+  }
+
+  readRect( m_saved, c_spriteWidth, x_, y_, width, height );
+  blit( pixelAt( x_, y_ ),
+        m_screen.GetLineLength() / sizeof( unsigned int ),
+        width,
+        height );
+
+  m_screen.Damage( y_, height );
+  m_visible = true;
+  m_x = x_;
+  m_y = y_;
+  m_width = width;
+  m_height = height;
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::Hide()
+{
+  if ( !m_visible )
+    return;
+
+  writeRect( m_saved, c_spriteWidth, m_x, m_y, m_width, m_height );
+  m_screen.Damage( m_y, m_height );
+  m_visible = false;
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::Discard()
+{
+  // The pixels under the sprite are gone, e.g. after a mode switch
+  m_visible = false;
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::Scroll(int dy_)
+{
+  // The console moved the arrow up along with the text, together with the
+  // pixels it covers, so the saved box goes back at the new place
+  if ( !m_visible || dy_ <= 0 )
+    return;
+
+  const int skip = dy_ - m_y;
+  if ( skip >= m_height )
+  {
+    m_visible = false;
+    return;
+  }
+
+  if ( skip > 0 )
+  {
+    writeRect( m_saved + skip * c_spriteWidth, c_spriteWidth,
+               m_x, 0, m_width, m_height - skip );
+    m_screen.Damage( 0, m_height - skip );
+    m_visible = false;
+    return;
+  }
+
+  m_y -= dy_;
+  Hide();
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::clip(int x_, int y_, int & width_, int & height_) const
+{
+  width_ = m_screen.GetWidth() - x_;
+  if ( width_ > c_spriteWidth )
+    width_ = c_spriteWidth;
+
+  height_ = m_screen.GetHeight() - y_;
+  if ( height_ > c_spriteHeight )
+    height_ = c_spriteHeight;
+}
+//-----------------------------------------------------------------------------
+unsigned int * PspMdPointer::pixelAt(int x_, int y_) const
+{
+  return (unsigned int *)( (char *)m_screen.GetDrawAddress() +
+                           y_ * m_screen.GetLineLength() ) + x_;
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::readRect
+(
+  unsigned int * to_,
+  int toStride_,
+  int x_,
+  int y_,
+  int width_,
+  int height_
+) const
+{
+  copyRect( to_, toStride_,
+            pixelAt( x_, y_ ),
+            m_screen.GetLineLength() / sizeof( unsigned int ),
+            width_, height_ );
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::writeRect
+(
+  const unsigned int * from_,
+  int fromStride_,
+  int x_,
+  int y_,
+  int width_,
+  int height_
+) const
+{
+  copyRect( pixelAt( x_, y_ ),
+            m_screen.GetLineLength() / sizeof( unsigned int ),
+            from_, fromStride_,
+            width_, height_ );
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::blit
+(
+  unsigned int * to_,
+  int toStride_,
+  int width_,
+  int height_
+) const
+{
+  const unsigned int * mask = m_mask;
+  const unsigned int * color = m_color;
+
+  for ( int i = 0; i < height_; i++ )
+  {
+    for ( int j = 0; j < width_; j++ )
+      to_[ j ] = ( to_[ j ] & mask[ j ] ) | color[ j ];
+
+    to_ += toStride_;
+    mask += c_spriteWidth;
+    color += c_spriteWidth;
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMdPointer::copyRect
+(
+  unsigned int * to_,
+  int toStride_,
+  const unsigned int * from_,
+  int fromStride_,
+  int width_,
+  int height_
+)
+{
+  const int bytes = width_ * sizeof( unsigned int );
+
+  for ( int i = 0; i < height_; i++ )
+  {
+    memcpy( to_, from_, bytes );
+    to_ += toStride_;
+    from_ += fromStride_;
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
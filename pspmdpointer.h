@@ -0,0 +1,75 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDPOINTER_H
+#define PSPMDPOINTER_H
+
+class PspMdScreen;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdPointer
+//
+// Pixel accurate arrow pointer drawn with a save-under buffer. The sprite
+// is converted to the framebuffer pixel format once, as an AND mask and an
+// OR colour per pixel, so blitting it needs no per-pixel branch. A move
+// whose old and new boxes overlap is composed off screen over the union of
+// the two boxes and written back in one pass; disjoint moves restore and
+// draw the two boxes separately.
+//-----------------------------------------------------------------------------
+class PspMdPointer
+{
+public:
+  PspMdPointer(PspMdScreen & screen_);
+  ~PspMdPointer();
+
+  bool Initialize();
+  void Show(int x_, int y_);
+  void Hide();
+  void Discard();
+  void Scroll(int dy_);
+
+  bool IsEnabled() const  { return m_mask != NULL; }
+  bool IsVisible() const  { return m_visible; }
+  int GetX() const        { return m_x; }
+  int GetY() const        { return m_y; }
+
+protected:
+  void clip(int x_, int y_, int & width_, int & height_) const;
+  unsigned int * pixelAt(int x_, int y_) const;
+  void readRect(unsigned int * to_, int toStride_,
+                int x_, int y_, int width_, int height_) const;
+  void writeRect(const unsigned int * from_, int fromStride_,
+                 int x_, int y_, int width_, int height_) const;
+  void blit(unsigned int * to_, int toStride_, int width_, int height_) const;
+  static void copyRect(unsigned int * to_, int toStride_,
+                       const unsigned int * from_, int fromStride_,
+                       int width_, int height_);
+
+  PspMdScreen &   m_screen;
+  unsigned int *  m_mask;       // Sprite AND mask, framebuffer format
+  unsigned int *  m_color;      // Sprite OR colour, framebuffer format
+  unsigned int *  m_saved;      // Pixels under the sprite
+  unsigned int *  m_scratch;    // Union box of a move
+  bool            m_visible;
+  int             m_x;
+  int             m_y;
+  int             m_width;      // Clipped size of the saved box
+  int             m_height;
+
+private:
+  // Not implemented
+  PspMdPointer();
+  PspMdPointer(const PspMdPointer &);
+  PspMdPointer & operator = (const PspMdPointer &);
+};
+
+
+#endif  // PSPMDPOINTER_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
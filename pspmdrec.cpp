@@ -0,0 +1,133 @@
+/*-----------------------------------------------------------------------------
+ * Flight recorder formatter for the PSP Mouse Daemon
+ * Decodes a dump written by PspMdRecorder::Dump() into readable text
+ *---------------------------------------------------------------------------*/
+#include "pspmdrecorder.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const char * const c_eventNames[] =
+{
+  PSPMD_EVENTS( PSPMD_EVENT_NAME )
+};
+
+static const char * const c_devNames[ DEV_MAX ] =
+{
+  "vcs",
+  "fb",
+  "mouse"
+};
+
+
+//-----------------------------------------------------------------------------
+// Prototypes
+//-----------------------------------------------------------------------------
+static bool decode(FILE * file_);
+static void printRecord(const psp_md_record_t & rec_);
+
+
+//-----------------------------------------------------------------------------
+// Implementations
+//-----------------------------------------------------------------------------
+int main(int argc_, char * argv_[])
+{
+  if ( argc_ != 2 || strcmp( argv_[ 1 ], "--help" ) == 0 )
+  {
+    printf( "Usage: pspmdrec <dump file>\n" );
+    return 0;
+  }
+
+  FILE * file = fopen( argv_[ 1 ], "rb" );
+  if ( file == NULL )
+  {
+    fprintf( stderr, "Failed to open %s\n", argv_[ 1 ] );
+    return -1;
+  }
+
+  bool ok = decode( file );
+  fclose( file );
+
+  return ok ? 0 : -1;
+}
+//-----------------------------------------------------------------------------
+static bool decode(FILE * file_)
+{
+  psp_md_rec_header_t header;
+  if ( fread( &header, sizeof( header ), 1, file_ ) != 1 ||
+       header.magic != c_recMagic )
+  {
+    fprintf( stderr, "Not a recorder dump\n" );
+    return false;
+  }
+
+  if ( header.version != c_recVersion ||
+       header.recordSize != sizeof( psp_md_record_t ) ||
+       header.recordCount == 0 ||
+       ( header.recordCount & ( header.recordCount - 1 ) ) != 0 )
+  {
+    fprintf( stderr, "Unsupported dump, version=%u\n", header.version );
+    return false;
+  }
+
+  psp_md_record_t * records = new psp_md_record_t[ header.recordCount ];
+  if ( fread( records, sizeof( psp_md_record_t ), header.recordCount, file_ )
+         != header.recordCount )
+  {
+    fprintf( stderr, "Truncated dump\n" );
+    delete[] records;
+    return false;
+  }
+
+  // Walk the ring from the oldest slot, skipping empty and torn slots
+  const unsigned int mask = header.recordCount - 1;
+  const unsigned int first = ( header.nextSeq > header.recordCount ) ?
+                             header.nextSeq - header.recordCount : 1;
+
+  for ( unsigned int seq = first; seq != header.nextSeq; seq++ )
+  {
+    const psp_md_record_t & rec = records[ seq & mask ];
+    if ( rec.seq == seq )
+      printRecord( rec );
+  }
+
+  delete[] records;
+  return true;
+}
+//-----------------------------------------------------------------------------
+static void printRecord(const psp_md_record_t & rec_)
+{
+  const char * name = ( rec_.id < EVT_MAX ) ? c_eventNames[ rec_.id ] : "?";
+
+  printf( "%8u %6u.%03u %-18s", rec_.seq,
+          rec_.msec / 1000, rec_.msec % 1000, name );
+
+  switch ( rec_.id )
+  {
+  case EVT_OPEN_FAIL:
+  case EVT_IOCTL_FAIL:
+  case EVT_MMAP_FAIL:
+  case EVT_READ_FAIL:
+  case EVT_WRITE_FAIL:
+  case EVT_SYNC_FAIL:
+    if ( rec_.args[ 0 ] >= 0 && rec_.args[ 0 ] < DEV_MAX )
+      printf( " dev=%s", c_devNames[ rec_.args[ 0 ] ] );
+    printf( " errno=%d arg=%d\n", rec_.args[ 1 ], rec_.args[ 2 ] );
+    break;
+
+  default:
+    printf( " %d %d %d\n", rec_.args[ 0 ], rec_.args[ 1 ], rec_.args[ 2 ] );
+    break;
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
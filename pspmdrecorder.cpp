@@ -0,0 +1,147 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+
+static const int c_fatalSignals[]         =
+{
+  SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdRecorder
+//-----------------------------------------------------------------------------
+PspMdRecorder * PspMdRecorder::s_instance = NULL;
+//-----------------------------------------------------------------------------
+PspMdRecorder::PspMdRecorder()
+  : m_nextSeq( 1 ),
+    m_msec( 0 ),
+    m_startSec( 0 ),
+    m_fileName( NULL )
+{
+  memset( (void *)m_records, 0, sizeof( m_records ) );
+}
+//-----------------------------------------------------------------------------
+PspMdRecorder::~PspMdRecorder()
+{
+  if ( s_instance == this )
+    s_instance = NULL;
+}
+//-----------------------------------------------------------------------------
+bool PspMdRecorder::Initialize(const char * fileName_)
+{
+  if ( s_instance != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdRecorder has been initialized\n" ));
+    return true;
+  }
+
+  struct timeval now;
+  (void)gettimeofday( &now, NULL );
+  m_startSec = now.tv_sec;
+  m_fileName = fileName_;
+  s_instance = this;
+
+  struct sigaction sa;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = onSignal;
+  sigemptyset( &sa.sa_mask );
+
+  // A dump request must not break the blocking read of the mouse
+  sa.sa_flags = SA_RESTART;
+  if ( sigaction( SIGUSR1, &sa, NULL ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to install the dump signal handler\n" ));
+    return false;
+  }
+
+  sa.sa_flags = SA_RESETHAND;
+  for ( unsigned int i = 0;
+        i < sizeof( c_fatalSignals ) / sizeof( c_fatalSignals[ 0 ] );
+        i++ )
+  {
+    (void)sigaction( c_fatalSignals[ i ], &sa, NULL );
+  }
+
+  Tick();
+  Record( EVT_START, (int)getpid() );
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdRecorder::Tick()
+{
+  struct timeval now;
+  (void)gettimeofday( &now, NULL );
+  m_msec = (unsigned int)( ( now.tv_sec - m_startSec ) * 1000 +
+                           now.tv_usec / 1000 );
+}
+//-----------------------------------------------------------------------------
+bool PspMdRecorder::Dump()
+{
+  // Must stay async-signal-safe, it runs from the signal handlers
+  if ( m_fileName == NULL )
+    return false;
+
+  int fd = open( m_fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if ( fd < 0 )
+    return false;
+
+  psp_md_rec_header_t header;
+  header.magic       = c_recMagic;
+  header.version     = c_recVersion;
+  header.recordSize  = sizeof( psp_md_record_t );
+  header.recordCount = RECORD_COUNT;
+  header.nextSeq     = m_nextSeq;
+
+  bool ok = ( write( fd, &header, sizeof( header ) ) == sizeof( header ) &&
+              write( fd, (const void *)m_records, sizeof( m_records ) ) ==
+                sizeof( m_records ) );
+
+  (void)close( fd );
+  return ok;
+}
+//-----------------------------------------------------------------------------
+void * PspMdRecorder::Adopt(unsigned int nextSeq_, long startSec_)
+{
+  // Continues the sequence and the clock of the previous instance, whose
+  // records the caller copies into the returned ring
+  m_nextSeq = nextSeq_;
+  m_startSec = startSec_;
+  Tick();
+  return (void *)m_records;
+}
+//-----------------------------------------------------------------------------
+void PspMdRecorder::onSignal(int signo_)
+{
+  if ( s_instance == NULL )
+    return;
+
+  s_instance->Record( EVT_SIGNAL, signo_ );
+  (void)s_instance->Dump();
+
+  // The fatal handlers are reset on delivery, re-raise to get the core
+  if ( signo_ != SIGUSR1 )
+    (void)raise( signo_ );
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,157 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDRECORDER_H
+#define PSPMDRECORDER_H
+
+
+//-----------------------------------------------------------------------------
+// Events
+//
+// The list is shared with the offline formatter (pspmdrec), so new events
+// must only ever be appended.
+//-----------------------------------------------------------------------------
+#define PSPMD_EVENTS(E) \
+  E( EVT_NONE )         \
+  E( EVT_START )        \
+  E( EVT_STOP )         \
+  E( EVT_SIGNAL )       \
+  E( EVT_OPEN_FAIL )    \
+  E( EVT_IOCTL_FAIL )   \
+  E( EVT_MMAP_FAIL )    \
+  E( EVT_SEEK_FAIL )    \
+  E( EVT_READ_FAIL )    \
+  E( EVT_WRITE_FAIL )   \
+  E( EVT_SYNC_FAIL )    \
+  E( EVT_ALLOC_FAIL )   \
+  E( EVT_FAILED_STATE ) \
+  E( EVT_COPY )         \
+  E( EVT_PASTE )        \
+  E( EVT_SCHED_FAIL )   \
+  E( EVT_MLOCK_FAIL )   \
+  E( EVT_GEOMETRY )     \
+  E( EVT_NO_BACK_PAGE ) \
+  E( EVT_SCROLL_TRACKED ) \
+  E( EVT_RENDERER )     \
+  E( EVT_IDLE )         \
+  E( EVT_RESTORE )      \
+  E( EVT_HANDOFF )      \
+  E( EVT_TAKEOVER )     \
+  E( EVT_HANDOFF_FAIL ) \
+  E( EVT_CONTROL )
+
+#define PSPMD_EVENT_ENUM(name_)   name_,
+#define PSPMD_EVENT_NAME(name_)   #name_,
+
+enum
+{
+  PSPMD_EVENTS( PSPMD_EVENT_ENUM )
+  EVT_MAX
+};
+
+// Device ids carried in the first argument of device events
+enum
+{
+  DEV_VCS = 0,
+  DEV_FB,
+  DEV_MOUSE,
+  DEV_MAX
+};
+
+
+//-----------------------------------------------------------------------------
+// Type definitions
+//-----------------------------------------------------------------------------
+static const unsigned int c_recMagic      = 0x4c444d50;  // "PMDL"
+static const unsigned int c_recVersion    = 1;
+static const unsigned int c_recArgs       = 3;
+
+typedef struct
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned int recordSize;
+  unsigned int recordCount;
+  unsigned int nextSeq;
+} psp_md_rec_header_t;
+
+typedef struct
+{
+  unsigned int seq;
+  unsigned int msec;
+  unsigned int id;
+  int args[ c_recArgs ];
+} psp_md_record_t;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdRecorder
+//
+// Fixed size in-memory flight recorder. Record() only fills a ring slot, it
+// never does any I/O; the ring is written out as a binary file by Dump(),
+// which is called on SIGUSR1, on fatal signals and on explicit request.
+// Only the daemon thread writes, so the ring needs no locking. The sequence
+// number of a slot is stored last, which lets a dump taken from a signal
+// handler tell a torn slot from a complete one.
+//-----------------------------------------------------------------------------
+class PspMdRecorder
+{
+public:
+  enum { RECORD_COUNT = 256 };   // Must be a power of 2
+
+  PspMdRecorder();
+  ~PspMdRecorder();
+
+  bool Initialize(const char * fileName_);
+  void Tick();
+  bool Dump();
+
+  unsigned int GetMsec() const  { return m_msec; }
+
+  // The ring goes over to the next instance on an upgrade, so one dump
+  // covers both
+  const void * GetRecords() const   { return (const void *)m_records; }
+  int GetRecordsSize() const        { return sizeof( m_records ); }
+  unsigned int GetNextSeq() const   { return m_nextSeq; }
+  long GetStartSec() const          { return m_startSec; }
+  void * Adopt(unsigned int nextSeq_, long startSec_);
+
+  void Record(unsigned int id_, int arg0_ = 0, int arg1_ = 0, int arg2_ = 0)
+  {
+    unsigned int seq = m_nextSeq++;
+    volatile psp_md_record_t & rec = m_records[ seq & ( RECORD_COUNT - 1 ) ];
+    rec.seq = 0;
+    rec.msec = m_msec;
+    rec.id = id_;
+    rec.args[ 0 ] = arg0_;
+    rec.args[ 1 ] = arg1_;
+    rec.args[ 2 ] = arg2_;
+    rec.seq = seq;
+  }
+
+protected:
+  static void onSignal(int signo_);
+
+  static PspMdRecorder * s_instance;
+
+  volatile psp_md_record_t m_records[ RECORD_COUNT ];
+  volatile unsigned int m_nextSeq;
+  unsigned int m_msec;
+  long m_startSec;
+  const char * m_fileName;
+
+private:
+  // Not implemented
+  PspMdRecorder(const PspMdRecorder &);
+  PspMdRecorder & operator = (const PspMdRecorder &);
+};
+
+
+#endif  // PSPMDRECORDER_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,163 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const int INVALID_FD               = -1;
+static const int c_ringSize               = sizeof( PspMdRingHeader ) +
+                                            PSPMD_RING_SLOTS *
+                                            sizeof( PspMdRingEvent );
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdRing
+//-----------------------------------------------------------------------------
+PspMdRing::PspMdRing()
+  : m_header( NULL ),
+    m_events( NULL ),
+    m_fd( INVALID_FD )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdRing::~PspMdRing()
+{
+  if ( m_header != NULL )
+  {
+    // Tell the clients there is no writer any more
+    m_header->magic = 0;
+    (void)munmap( (void *)m_header, c_ringSize );
+    m_header = NULL;
+    m_events = NULL;
+  }
+
+  if ( m_fd >= 0 )
+  {
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdRing::Initialize(const char * fileName_)
+{
+  if ( m_header != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdRing has been initialized\n" ));
+    return true;
+  }
+
+  // A file on the RAM disk sized up front can be mapped shared without
+  // an MMU
+  m_fd = open( fileName_, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+  if ( m_fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to create event ring %s, err=%d\n",
+          fileName_, errno ));
+    return false;
+  }
+
+  void * addr = MAP_FAILED;
+  if ( ftruncate( m_fd, c_ringSize ) == 0 )
+  {
+    addr = mmap( NULL, c_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 m_fd, 0 );
+  }
+
+  if ( addr == MAP_FAILED )
+  {
+    DBG(( DBG_PREFIX "Failed to map event ring %s, err=%d\n",
+          fileName_, errno ));
+    (void)close( m_fd );
+    m_fd = INVALID_FD;
+    return false;
+  }
+
+  memset( addr, 0, c_ringSize );
+  m_header = (volatile PspMdRingHeader *)addr;
+  m_events = (volatile PspMdRingEvent *)( (char *)addr +
+                                          sizeof( PspMdRingHeader ) );
+
+  // Every slot starts busy so nothing is read before it is written
+  for ( int i = 0; i < PSPMD_RING_SLOTS; i++ )
+    m_events[ i ].seq = PSPMD_RING_BUSY;
+
+  m_header->version = PSPMD_RING_VERSION;
+  m_header->slots = PSPMD_RING_SLOTS;
+  m_header->magic = PSPMD_RING_MAGIC;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdRing::SetGeometry(int width_, int height_, int cols_, int rows_)
+{
+  if ( m_header == NULL )
+    return;
+
+  m_header->width = width_;
+  m_header->height = height_;
+  m_header->cols = cols_;
+  m_header->rows = rows_;
+}
+//-----------------------------------------------------------------------------
+void PspMdRing::Publish(const PspMdEvent & event_, int col_, int row_)
+{
+  if ( m_header == NULL )
+    return;
+
+  // The slot is busy while it is filled, the volatile stores keep their
+  // order
+  const unsigned int seq = m_header->head;
+  volatile PspMdRingEvent & slot = m_events[ seq & ( PSPMD_RING_SLOTS - 1 ) ];
+
+  slot.seq = PSPMD_RING_BUSY;
+  slot.buttons = event_.buttons;
+  slot.x = (short)event_.x;
+  slot.y = (short)event_.y;
+  slot.col = (short)col_;
+  slot.row = (short)row_;
+  slot.seq = seq;
+
+  m_header->head = seq + 1;
+}
+//-----------------------------------------------------------------------------
+bool PspMdRing::IsGrabbed()
+{
+  if ( m_header == NULL )
+    return false;
+
+  const int pid = m_header->grabPid;
+  if ( pid == 0 )
+    return false;
+
+  // A client that died holding the mouse gives it back
+  if ( kill( pid, 0 ) < 0 && errno == ESRCH )
+  {
+    m_header->grabPid = 0;
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+int PspMdRing::GetMappedSize() const
+{
+  return ( m_header != NULL ) ? c_ringSize : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
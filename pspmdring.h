@@ -0,0 +1,92 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDRING_H
+#define PSPMDRING_H
+
+struct PspMdEvent;
+
+
+//-----------------------------------------------------------------------------
+// Shared ring layout
+//
+// The daemon is the only writer. A client maps the file, starts reading at
+// head and keeps its own position; slot (position % PSPMD_RING_SLOTS) holds
+// the event once its seq equals the position. The writer marks a slot as
+// busy while filling it, so a client reads seq, copies the slot and reads
+// seq again, and drops the copy unless both equal its position. A client
+// that fell more than a ring behind starts again at head.
+//
+// A client takes the mouse by storing its pid in grabPid and gives it
+// back by storing 0. While the mouse is taken the daemon still moves the
+// cursor, but makes no selection.
+//-----------------------------------------------------------------------------
+#define PSPMD_RING_MAGIC    0x52444d50    // "PMDR"
+#define PSPMD_RING_VERSION  1
+#define PSPMD_RING_SLOTS    256           // A power of two
+#define PSPMD_RING_BUSY     0xffffffff
+
+struct PspMdRingEvent
+{
+  unsigned int    seq;
+  unsigned int    buttons;    // PspMdMouse::BUTTON_* bits
+  short           x;          // Pointer position in pixels
+  short           y;
+  short           col;        // Console cell under the pointer
+  short           row;
+};
+
+struct PspMdRingHeader
+{
+  unsigned int    magic;
+  unsigned int    version;
+  unsigned int    slots;
+  unsigned int    head;       // Events written so far
+  int             grabPid;
+  int             width;      // Screen and console size
+  int             height;
+  int             cols;
+  int             rows;
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdRing
+//
+// Writer side of the shared ring. Delivering an event is one slot write
+// and one head update, whatever the number of clients.
+//-----------------------------------------------------------------------------
+class PspMdRing
+{
+public:
+  PspMdRing();
+  ~PspMdRing();
+
+  bool Initialize(const char * fileName_);
+  void SetGeometry(int width_, int height_, int cols_, int rows_);
+  void Publish(const PspMdEvent & event_, int col_, int row_);
+  bool IsGrabbed();
+  int GetMappedSize() const;
+
+  bool IsEnabled() const  { return m_header != NULL; }
+
+protected:
+  volatile PspMdRingHeader *  m_header;
+  volatile PspMdRingEvent *   m_events;
+  int                         m_fd;
+
+private:
+  // Not implemented
+  PspMdRing(const PspMdRing &);
+  PspMdRing & operator = (const PspMdRing &);
+};
+
+
+#endif  // PSPMDRING_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const unsigned int c_lowBits       = 0x01010101;
+static const unsigned int c_highBits      = 0x80808080;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdSearch
+//-----------------------------------------------------------------------------
+PspMdSearch::PspMdSearch()
+  : m_pattern( NULL ),
+    m_length( 0 ),
+    m_matches( NULL ),
+    m_count( 0 ),
+    m_cols( 0 ),
+    m_size( 0 )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdSearch::~PspMdSearch()
+{
+  delete[] m_pattern;
+  delete[] m_matches;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSearch::Resize(int cols_, int rows_)
+{
+  // The matches belong to the old layout, the pattern stays if it still
+  // fits in a row
+  m_count = 0;
+
+  if ( cols_ == m_cols && cols_ * rows_ == m_size )
+    return true;
+
+  PspMdArena::Scope scope( PspMdArena::TAG_SEARCH );
+  char * pattern = new char[ cols_ ];
+  int * matches = new int[ cols_ * rows_ ];
+  if ( pattern == NULL || matches == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to allocate the search buffers\n" ));
+    delete[] pattern;
+    delete[] matches;
+    return false;
+  }
+
+  if ( m_length > cols_ )
+    m_length = 0;
+  if ( m_length > 0 )
+    memcpy( pattern, m_pattern, m_length );
+
+  delete[] m_pattern;
+  delete[] m_matches;
+  m_pattern = pattern;
+  m_matches = matches;
+  m_cols = cols_;
+  m_size = cols_ * rows_;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSearch::SetPattern(const char * text_, int size_)
+{
+  Clear();
+
+  // Blanks alone would match most of the screen
+  int i;
+  for ( i = 0; i < size_ && text_[ i ] == ' '; i++ )
+    ;
+
+  if ( size_ > m_cols || i == size_ || memchr( text_, '\n', size_ ) != NULL )
+    return false;
+
+  memcpy( m_pattern, text_, size_ );
+  m_length = size_;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdSearch::Clear()
+{
+  m_length = 0;
+  m_count = 0;
+}
+//-----------------------------------------------------------------------------
+void PspMdSearch::Forget()
+{
+  m_count = 0;
+}
+//-----------------------------------------------------------------------------
+int PspMdSearch::Find(const char * text_, int skipFrom_, int skipTo_)
+{
+  m_count = 0;
+  if ( m_length == 0 || text_ == NULL )
+    return 0;
+
+  // A byte equal to the first character turns into a zero byte, and a
+  // word with a zero byte has the top bit of (x - 0x01..) & ~x set
+  const unsigned int first = (unsigned char)m_pattern[ 0 ] * c_lowBits;
+  const int last = m_size - m_length;
+  int next = 0;
+  int i = 0;
+
+  for ( ; i <= last && i + (int)sizeof( unsigned int ) <= m_size;
+        i += sizeof( unsigned int ) )
+  {
+    unsigned int word;
+    memcpy( &word, text_ + i, sizeof( word ) );
+    word ^= first;
+    if ( ( ( word - c_lowBits ) & ~word & c_highBits ) == 0 )
+      continue;
+
+    for ( int j = i; j < i + (int)sizeof( unsigned int ) && j <= last; j++ )
+    {
+      if ( j >= next && matchAt( text_, j ) &&
+           ( j > skipTo_ || j + m_length <= skipFrom_ ) )
+      {
+        m_matches[ m_count++ ] = j;
+        next = j + m_length;
+      }
+    }
+  }
+
+  for ( ; i <= last; i++ )
+  {
+    if ( i >= next && matchAt( text_, i ) &&
+         ( i > skipTo_ || i + m_length <= skipFrom_ ) )
+    {
+      m_matches[ m_count++ ] = i;
+      next = i + m_length;
+    }
+  }
+
+  return m_count;
+}
+//-----------------------------------------------------------------------------
+void PspMdSearch::Shift(int cells_)
+{
+  // The text went up. Matches that left the screen are dropped, one cut
+  // by the top edge starts above it.
+  int count = 0;
+
+  for ( int i = 0; i < m_count; i++ )
+  {
+    if ( m_matches[ i ] + m_length > cells_ )
+      m_matches[ count++ ] = m_matches[ i ] - cells_;
+  }
+
+  m_count = count;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSearch::matchAt(const char * text_, int pos_) const
+{
+  return text_[ pos_ ] == m_pattern[ 0 ] &&
+         memcmp( text_ + pos_ + 1, m_pattern + 1, m_length - 1 ) == 0;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
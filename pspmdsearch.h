@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDSEARCH_H
+#define PSPMDSEARCH_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdSearch
+//
+// Finds the occurrences of a pattern of at most one row in the console
+// text. The text is scanned a word at a time for bytes equal to the first
+// character of the pattern, and only those candidates are compared in
+// full, so a screen without the character costs one XOR and a few ALU
+// operations per four cells. Matches do not overlap.
+//-----------------------------------------------------------------------------
+class PspMdSearch
+{
+public:
+  PspMdSearch();
+  ~PspMdSearch();
+
+  bool Resize(int cols_, int rows_);
+  bool SetPattern(const char * text_, int size_);
+  void Clear();
+  void Forget();
+  int Find(const char * text_, int skipFrom_, int skipTo_);
+  void Shift(int cells_);
+
+  bool IsActive() const           { return m_length > 0; }
+  int GetLength() const           { return m_length; }
+  int GetCount() const            { return m_count; }
+  int GetMatch(int index_) const  { return m_matches[ index_ ]; }
+
+protected:
+  bool matchAt(const char * text_, int pos_) const;
+
+  char *  m_pattern;
+  int     m_length;
+  int *   m_matches;        // First cell of every match
+  int     m_count;
+  int     m_cols;
+  int     m_size;           // Console cells
+
+private:
+  // Not implemented
+  PspMdSearch(const PspMdSearch &);
+  PspMdSearch & operator = (const PspMdSearch &);
+};
+
+
+#endif  // PSPMDSEARCH_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,165 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const unsigned int c_hashSeed      = 2166136261u;
+static const unsigned int c_hashPrime     = 16777619u;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdSnapshot
+//-----------------------------------------------------------------------------
+PspMdSnapshot::PspMdSnapshot()
+  : m_text( NULL ),
+    m_hashes( NULL ),
+    m_prevHashes( NULL ),
+    m_blankHash( 0 ),
+    m_cols( 0 ),
+    m_rows( 0 ),
+    m_valid( false ),
+    m_prevValid( false )
+{
+}
+//-----------------------------------------------------------------------------
+PspMdSnapshot::~PspMdSnapshot()
+{
+  delete[] m_text;
+  delete[] m_hashes;
+  delete[] m_prevHashes;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSnapshot::Resize(int cols_, int rows_)
+{
+  Invalidate();
+
+  if ( cols_ == m_cols && rows_ == m_rows && m_text != NULL )
+    return true;
+
+  delete[] m_text;
+  delete[] m_hashes;
+  delete[] m_prevHashes;
+
+  PspMdArena::Scope scope( PspMdArena::TAG_SNAPSHOT );
+  m_text       = new char[ cols_ * rows_ ];
+  m_hashes     = new unsigned int[ rows_ ];
+  m_prevHashes = new unsigned int[ rows_ ];
+  if ( m_text == NULL || m_hashes == NULL || m_prevHashes == NULL )
+  {
+    DBG(( DBG_PREFIX "Failed to allocate the console snapshot\n" ));
+    m_cols = 0;
+    m_rows = 0;
+    return false;
+  }
+
+  m_cols = cols_;
+  m_rows = rows_;
+
+  memset( m_text, ' ', m_cols );
+  m_blankHash = hashRow( m_text, m_cols );
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSnapshot::Capture(PspMdConsole & console_)
+{
+  if ( m_text == NULL )
+    return false;
+
+  const unsigned int size = m_cols * m_rows;
+  unsigned int bytesRead = 0;
+
+  if ( !console_.Seek( 0 ) ||
+       !console_.Read( m_text, size, bytesRead ) ||
+       bytesRead != size )
+  {
+    Invalidate();
+    return false;
+  }
+
+  unsigned int * hashes = m_prevHashes;
+  m_prevHashes = m_hashes;
+  m_hashes = hashes;
+
+  for ( int i = 0; i < m_rows; i++ )
+    m_hashes[ i ] = hashRow( m_text + i * m_cols, m_cols );
+
+  m_prevValid = m_valid;
+  m_valid = true;
+  return true;
+}
+//-----------------------------------------------------------------------------
+int PspMdSnapshot::FindScroll() const
+{
+  if ( !m_valid || !m_prevValid )
+    return 0;
+
+  // The last row kept on screen may have been typed on since, so it does
+  // not have to match. Everything above it must, with at least one row that
+  // is not blank, or an empty screen would match any offset.
+  for ( int offset = 1; offset < m_rows - 1; offset++ )
+  {
+    const int overlap = m_rows - offset - 1;
+    bool matched = false;
+    int i;
+
+    for ( i = 0; i < overlap; i++ )
+    {
+      if ( m_hashes[ i ] != m_prevHashes[ i + offset ] )
+        break;
+      if ( m_hashes[ i ] != m_blankHash )
+        matched = true;
+    }
+
+    if ( i == overlap && matched )
+      return offset;
+  }
+
+  return 0;
+}
+//-----------------------------------------------------------------------------
+void PspMdSnapshot::Invalidate()
+{
+  m_valid = false;
+  m_prevValid = false;
+}
+//-----------------------------------------------------------------------------
+bool PspMdSnapshot::HasChanged() const
+{
+  return !m_prevValid ||
+         memcmp( m_hashes, m_prevHashes, m_rows * sizeof( unsigned int ) ) != 0;
+}
+//-----------------------------------------------------------------------------
+unsigned int PspMdSnapshot::hashRow(const char * row_, int cols_)
+{
+  // FNV-1a over whole words, then the odd characters at the end
+  unsigned int hash = c_hashSeed;
+  int i = 0;
+
+  for ( ; i + (int)sizeof( unsigned int ) <= cols_; i += sizeof( unsigned int ) )
+  {
+    unsigned int word;
+    memcpy( &word, row_ + i, sizeof( word ) );
+    hash = ( hash ^ word ) * c_hashPrime;
+  }
+
+  for ( ; i < cols_; i++ )
+    hash = ( hash ^ (unsigned char)row_[ i ] ) * c_hashPrime;
+
+  return hash;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,64 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDSNAPSHOT_H
+#define PSPMDSNAPSHOT_H
+
+class PspMdConsole;
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdSnapshot
+//
+// Copy of the console text with a hash per row. Each capture keeps the row
+// hashes of the one before, so a vertical scroll between the two shows up
+// as the old rows reappearing some rows higher, found by comparing hashes
+// only. The text itself is read in one go and hashed a word at a time.
+//-----------------------------------------------------------------------------
+class PspMdSnapshot
+{
+public:
+  PspMdSnapshot();
+  ~PspMdSnapshot();
+
+  bool Resize(int cols_, int rows_);
+  bool Capture(PspMdConsole & console_);
+  int FindScroll() const;
+  void Invalidate();
+  bool HasChanged() const;
+
+  bool HasRowChanged(int row_) const
+  {
+    return !m_prevValid || m_hashes[ row_ ] != m_prevHashes[ row_ ];
+  }
+
+  bool IsValid() const          { return m_valid; }
+  const char * GetText() const  { return m_text; }
+
+protected:
+  static unsigned int hashRow(const char * row_, int cols_);
+
+  char *            m_text;
+  unsigned int *    m_hashes;       // Rows of the latest capture
+  unsigned int *    m_prevHashes;   // Rows of the capture before it
+  unsigned int      m_blankHash;
+  int               m_cols;
+  int               m_rows;
+  bool              m_valid;
+  bool              m_prevValid;
+
+private:
+  // Not implemented
+  PspMdSnapshot(const PspMdSnapshot &);
+  PspMdSnapshot & operator = (const PspMdSnapshot &);
+};
+
+
+#endif  // PSPMDSNAPSHOT_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -4,238 +4,1020 @@
  *---------------------------------------------------------------------------*/
 #include "pspmd.h"
 #include <stdio.h>
+#include <ctype.h>
+#include <string.h>
 
 
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::BaseState
+// Constants
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState::BaseState(PspMouseDaemon & md_)
-  : m_md( md_ )
+static const unsigned int c_multiClickMsec  = 400;
+static const int          c_scrollPixels    = 8;    // Pointer travel per line
+static const char         c_wordChars[]     = "-_./~:@%+";
+static const int          c_maxScrollback   = 4096; // Lines a selection reaches
+static const int          c_checkRows       = 3;    // Rows proving a scroll
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+enum
 {
+  CLASS_PUNCT = 0,
+  CLASS_WORD,
+  CLASS_BLANK
+};
+
+static int charClass(char c_)
+{
+  const unsigned char c = (unsigned char)c_;
+
+  if ( c == ' ' || c == 0 )
+    return CLASS_BLANK;
+  if ( isalnum( c ) || strchr( c_wordChars, c ) != NULL )
+    return CLASS_WORD;
+  return CLASS_PUNCT;
 }
+
+
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState * 
-PspMouseDaemon::BaseState::enterState()
+// Transition table
+//-----------------------------------------------------------------------------
+#define T(next_, action_) \
+  { PspMouseDaemon::next_, PspMouseDaemon::action_ }
+
+const PspMouseDaemon::Transition
+PspMouseDaemon::s_transitions[ STATE_MAX ][ INPUT_MAX ] =
 {
-  // Do nothing by default
-  return this;
-}
+  // STATE_FAILED
+  {
+    T( STATE_FAILED,        ACTION_NONE   ),  // MOTION
+    T( STATE_FAILED,        ACTION_NONE   ),  // LEFT_DOWN
+    T( STATE_FAILED,        ACTION_NONE   ),  // LEFT_DOUBLE
+    T( STATE_FAILED,        ACTION_NONE   ),  // LEFT_TRIPLE
+    T( STATE_FAILED,        ACTION_NONE   ),  // LEFT_UP
+    T( STATE_FAILED,        ACTION_NONE   ),  // MID_DOWN
+    T( STATE_FAILED,        ACTION_NONE   ),  // MID_UP
+    T( STATE_FAILED,        ACTION_NONE   ),  // RIGHT_DOWN
+    T( STATE_FAILED,        ACTION_NONE   )   // RIGHT_UP
+  },
+  // STATE_CURSOR
+  {
+    T( STATE_CURSOR,        ACTION_MOVE   ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_PASTE  ),
+    T( STATE_CURSOR,        ACTION_NONE   )
+  },
+  // STATE_SELECT
+  {
+    T( STATE_SELECT,        ACTION_EXTEND ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_SELECT,        ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT,        ACTION_NONE   )
+  },
+  // STATE_SELECT_WORD
+  {
+    T( STATE_SELECT_WORD,   ACTION_EXTEND ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   ),
+    T( STATE_SELECT_WORD,   ACTION_NONE   )
+  },
+  // STATE_SELECT_LINE
+  {
+    T( STATE_SELECT_LINE,   ACTION_EXTEND ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   ),
+    T( STATE_SELECT_LINE,   ACTION_NONE   )
+  },
+  // STATE_SELECT_BLOCK
+  {
+    T( STATE_SELECT_BLOCK,  ACTION_EXTEND ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   ),
+    T( STATE_SELECT_BLOCK,  ACTION_NONE   )
+  },
+  // STATE_SCROLL
+  {
+    T( STATE_SCROLL,        ACTION_SCROLL ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_CURSOR,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   ),
+    T( STATE_SCROLL,        ACTION_NONE   )
+  }
+};
+
+#undef T
+
+
 //-----------------------------------------------------------------------------
-void PspMouseDaemon::BaseState::exitState()
+// class PspMouseDaemon, state machine
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::serveEvents(const PspMdEvent * events_, int count_)
 {
-  // Do nothing by default
+  if ( !m_options.service )
+  {
+    processEvents( events_, count_ );
+    return;
+  }
+
+  if ( m_ring.IsEnabled() )
+  {
+    int col, row;
+    for ( int i = 0; i < count_; i++ )
+    {
+      screenToConsole( events_[ i ].x, events_[ i ].y, col, row );
+      m_ring.Publish( events_[ i ], col, row );
+    }
+
+    m_stats.Add( PspMdStats::EVENTS_PUBLISHED, count_ );
+  }
+
+  // Applications take the mouse between gestures only, a selection in
+  // progress is finished first
+  bool reporting = false;
+  if ( m_state == STATE_CURSOR &&
+       ( m_ring.IsGrabbed() ||
+         ( m_console.GetMouseReporting( reporting ) && reporting ) ) )
+  {
+    forwardEvents( events_, count_, reporting );
+  }
+  else
+  {
+    processEvents( events_, count_ );
+  }
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState *
-PspMouseDaemon::BaseState::processMouse
+void PspMouseDaemon::forwardEvents
 (
-  bool left_,
-  bool mid_,
-  bool right_,
-  int x_,
-  int y_
+  const PspMdEvent * events_,
+  int count_,
+  bool report_
 )
 {
-  // Do nothing by default
-  return this;
+  // The cursor keeps following the pointer, the buttons belong to the
+  // application
+  for ( int i = 0; i < count_; i++ )
+  {
+    const PspMdEvent & event = events_[ i ];
+    m_eventX = event.x;
+    m_eventY = event.y;
+    dispatch( INPUT_MOTION );
+
+    const unsigned int changed = event.buttons ^ m_buttons;
+    m_buttons = event.buttons;
+    if ( !report_ )
+      continue;
+
+    for ( int button = 0; button < 3; button++ )
+    {
+      const unsigned int mask = 1 << button;
+      if ( changed & mask )
+      {
+        (void)m_console.ReportMouse( ( event.buttons & mask ) ?
+                                     button :
+                                     PspMdConsole::REPORT_RELEASE,
+                                     m_col,
+                                     m_row );
+        m_stats.Add( PspMdStats::EVENTS_REPORTED );
+      }
+    }
+  }
 }
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::processEvents(const PspMdEvent * events_, int count_)
+{
+  for ( int i = 0; i < count_ && m_state != STATE_FAILED; i++ )
+  {
+    const PspMdEvent & event = events_[ i ];
+    m_eventX = event.x;
+    m_eventY = event.y;
+
+    // Buttons change at the position of their packet, so move there first
+    dispatch( INPUT_MOTION );
+
+    const unsigned int changed = event.buttons ^ m_buttons;
+    m_buttons = event.buttons;
 
+    if ( changed & PspMdMouse::BUTTON_LEFT )
+    {
+      dispatch( ( event.buttons & PspMdMouse::BUTTON_LEFT ) ?
+                pressInput() : INPUT_LEFT_UP );
+    }
+
+    if ( changed & PspMdMouse::BUTTON_MID )
+    {
+      dispatch( ( event.buttons & PspMdMouse::BUTTON_MID ) ?
+                INPUT_MID_DOWN : INPUT_MID_UP );
+    }
 
+    if ( changed & PspMdMouse::BUTTON_RIGHT )
+    {
+      dispatch( ( event.buttons & PspMdMouse::BUTTON_RIGHT ) ?
+                INPUT_RIGHT_DOWN : INPUT_RIGHT_UP );
+    }
+  }
+}
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::FailedState
+void PspMouseDaemon::dispatch(Input input_)
+{
+  const Transition & transition = s_transitions[ m_state ][ input_ ];
+
+  switch ( transition.action )
+  {
+  case ACTION_MOVE:
+    moveCursor();
+    break;
+
+  case ACTION_EXTEND:
+    screenToConsole( m_eventX, m_eventY, m_col, m_row );
+    autoScroll();
+    m_selection.Extend( m_col, m_row );
+    break;
+
+  case ACTION_SCROLL:
+    scroll();
+    break;
+
+  case ACTION_PASTE:
+    (void)pasteCb();
+    break;
+
+  default:
+    break;
+  }
+
+  changeState( (State)transition.next );
+}
 //-----------------------------------------------------------------------------
-PspMouseDaemon::FailedState::FailedState(PspMouseDaemon & md_)
-  : BaseState( md_ )
+PspMouseDaemon::Input PspMouseDaemon::pressInput()
 {
+  // Presses on the same cell in quick succession select words, then lines
+  int pos;
+  consoleToLinear( m_col, m_row, pos );
+
+  const unsigned int now = m_recorder.GetMsec();
+  if ( pos == m_clickPos && now - m_clickMsec <= c_multiClickMsec )
+    m_clickCount = ( m_clickCount % 3 ) + 1;
+  else
+    m_clickCount = 1;
+
+  m_clickPos = pos;
+  m_clickMsec = now;
+
+  if ( m_clickCount == 2 )
+    return INPUT_LEFT_DOUBLE;
+  if ( m_clickCount == 3 )
+    return INPUT_LEFT_TRIPLE;
+  return INPUT_LEFT_DOWN;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::changeState(State newState_)
+{
+  if ( newState_ == m_state )
+    return;
+
+  const State oldState = m_state;
+  m_state = newState_;
+  m_stats.Add( PspMdStats::STATE_TRANSITIONS );
+
+  // Leave the old state
+  if ( isSelecting( oldState ) && !isSelecting( newState_ ) )
+  {
+    m_selection.Copy();
+    m_selection.Settle();
+
+    if ( m_options.matches )
+      startSearch();
+  }
+  else if ( !isSelecting( oldState ) && isSelecting( newState_ ) )
+  {
+    // A new selection makes a new pattern
+    hideMatches();
+    m_search.Clear();
+  }
+
+  // Enter the new one
+  switch ( newState_ )
+  {
+  case STATE_FAILED:
+    m_recorder.Record( EVT_FAILED_STATE );
+    DBG(( DBG_PREFIX "Enter failure state!\n" ));
+    break;
+
+  case STATE_CURSOR:
+    (void)draw( m_col, m_row, true, false );
+    break;
+
+  case STATE_SELECT:
+    m_selection.Begin( Selection::MODE_CHAR, m_col, m_row );
+    break;
+
+  case STATE_SELECT_WORD:
+    m_selection.Begin( Selection::MODE_WORD, m_col, m_row );
+    break;
+
+  case STATE_SELECT_LINE:
+    m_selection.Begin( Selection::MODE_LINE, m_col, m_row );
+    break;
+
+  case STATE_SELECT_BLOCK:
+    m_selection.SetMode( Selection::MODE_BLOCK );
+    break;
+
+  case STATE_SCROLL:
+    // The console repaints while scrolling, keep the overlay off it
+    (void)clear( m_col, m_row, true, false );
+    m_scrollY = m_eventY;
+    break;
+
+  default:
+    break;
+  }
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState * 
-PspMouseDaemon::FailedState::enterState()
+bool PspMouseDaemon::isSelecting(State state_)
 {
-  DBG(( DBG_PREFIX "Enter failure state!\n" ));
-  return this;
+  return state_ >= STATE_SELECT && state_ <= STATE_SELECT_BLOCK;
 }
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::moveCursor()
+{
+  int col, row;
+  screenToConsole( m_eventX, m_eventY, col, row );
 
+  if ( col != m_col || row != m_row )
+  {
+    (void)clear( m_col, m_row, true, false );
+    (void)draw( col, row, true, false );
 
+    m_col = col;
+    m_row = row;
+  }
+}
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::CursorState
+void PspMouseDaemon::scroll()
+{
+  // Dragging down pulls older lines into view
+  const int lines = ( m_eventY - m_scrollY ) / c_scrollPixels;
+  if ( lines != 0 )
+  {
+    (void)m_console.Scroll( -lines );
+    m_scrollY += lines * c_scrollPixels;
+  }
+
+  screenToConsole( m_eventX, m_eventY, m_col, m_row );
+}
 //-----------------------------------------------------------------------------
-PspMouseDaemon::CursorState::CursorState(PspMouseDaemon & md_)
-  : BaseState( md_ )
+void PspMouseDaemon::autoScroll()
 {
+  // Dragging along the top or bottom edge moves the view a line per event
+  if ( m_eventY <= 0 )
+    m_selection.ScrollView( 1 );
+  else if ( m_eventY >= m_screen.GetHeight() - 1 )
+    m_selection.ScrollView( -1 );
 }
+
+
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState * 
-PspMouseDaemon::CursorState::enterState()
+// class PspMouseDaemon::Selection
+//-----------------------------------------------------------------------------
+PspMouseDaemon::Selection::Selection(PspMouseDaemon & md_)
+  : m_md( md_ ),
+    m_mode( MODE_CHAR ),
+    m_anchorBegin( 0 ),
+    m_anchorEnd( 0 ),
+    m_pos( 0 ),
+    m_empty( true ),
+    m_lineBuf( NULL ),
+    m_lineSize( 0 ),
+    m_base( 0 ),
+    m_scrollback( 0 ),
+    m_scrollLimit( c_maxScrollback ),
+    m_lineCount( 0 )
 {
-  // Draw the cursor
-  (void)m_md.draw( m_md.m_col, m_md.m_row, true, false );
-  (void)m_md.sync();
+  m_range.from = 0;
+  m_range.to = 0;
+  m_range.block = false;
+}
+//-----------------------------------------------------------------------------
+PspMouseDaemon::Selection::~Selection()
+{
+  delete[] m_lineBuf;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Selection::Resize(int cols_)
+{
+  // Positions stay on their screen cells in the new layout, Clamp() fits
+  // them in. A mode switch drops the scrollback and the lines seen in it.
+  const int base = c_maxScrollback * cols_;
+  m_anchorBegin += base - m_base;
+  m_anchorEnd += base - m_base;
+  m_range.from += base - m_base;
+  m_range.to += base - m_base;
+  if ( m_pos >= 0 )
+    m_pos += base - m_base;
+
+  m_base = base;
+  m_scrollback = 0;
+  m_scrollLimit = c_maxScrollback;
+  m_lines.Clear();
+  m_lineCount = 0;
+
+  if ( cols_ <= m_lineSize )
+    return true;
+
+  PspMdArena::Scope scope( PspMdArena::TAG_SELECTION );
+  char * buf = new char[ cols_ ];
+  if ( buf == NULL )
+  {
+    m_md.m_recorder.Record( EVT_ALLOC_FAIL, cols_ );
+    return false;
+  }
 
-  return this;
+  delete[] m_lineBuf;
+  m_lineBuf = buf;
+  m_lineSize = cols_;
+  return true;
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState *
-PspMouseDaemon::CursorState::processMouse
-(
-  bool left_,
-  bool mid_,
-  bool right_,
-  int x_,
-  int y_
-)
+void PspMouseDaemon::Selection::Begin(Mode mode_, int col_, int row_)
+{
+  // Clear the previous highlight area if there is any
+  Hide();
+
+  m_mode = mode_;
+  m_pos = toPos( col_, row_ );
+  unitAt( m_pos, m_anchorBegin, m_anchorEnd );
+
+  m_range.from = m_anchorBegin;
+  m_range.to = m_anchorEnd;
+  m_range.block = false;
+
+  // A single character only counts once the pointer has moved off it,
+  // until then nothing is drawn
+  m_empty = ( m_mode == MODE_CHAR );
+  if ( m_empty )
+  {
+    m_range.to = m_range.from - 1;
+  }
+  else
+  {
+    (void)m_md.clear( col_, row_, true, false );
+    (void)paint( m_range, NULL, true );
+  }
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Extend(int col_, int row_)
+{
+  extendTo( toPos( col_, row_ ) );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::SetMode(Mode mode_)
+{
+  m_mode = mode_;
+
+  // Redraw the current extent in the new shape
+  const int pos = m_pos;
+  m_pos = -1;
+  if ( !m_empty )
+    extendTo( pos );
+  else
+    m_pos = pos;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::ScrollView(int lines_)
 {
-  // Move the cursor
+  // Positive lines go back into the scrollback
+  const int cols = m_md.m_geometry.GetCols();
+  const int rows = m_md.m_consoleSize / cols;
+
+  if ( lines_ > m_scrollLimit - m_scrollback )
+    lines_ = m_scrollLimit - m_scrollback;
+  if ( lines_ < -m_scrollback )
+    lines_ = -m_scrollback;
+  if ( lines_ == 0 || cols > m_lineSize )
+    return;
+
+  // Reaching the edge is a drag, even if it started there
   int col, row;
-  m_md.screenToConsole( x_, y_, col, row );
+  if ( m_empty )
+  {
+    m_empty = false;
+    m_range.to = m_anchorEnd;
+    if ( toCell( m_anchorBegin, col, row ) )
+      (void)m_md.clear( col, row, true, false );
+  }
 
-  if ( col != m_md.m_col || row != m_md.m_row )
+  // The console repaints the cells, the overlay comes back on the text
+  // once it has moved
+  m_md.hideOverlay();
+
+  // The screen is kept whole before the view first moves away from it
+  if ( m_lineCount == 0 )
   {
-    (void)m_md.clear( m_md.m_col, m_md.m_row, true, false );
-    (void)m_md.draw( col, row, true, false );
-    (void)m_md.sync();
+    for ( row = rows - 1; row >= 0; row-- )
+    {
+      char * line = m_lines.Extend( cols );
+      if ( line == NULL || !readRow( row, line ) )
+      {
+        m_lines.Clear();
+        m_md.showOverlay();
+        return;
+      }
+    }
 
-    m_md.m_col = col;
-    m_md.m_row = row;
+    m_lineCount = rows;
   }
 
-  if ( left_ )
+  if ( lines_ > 0 )
+  {
+    while ( lines_-- > 0 && stepBack() )
+      ;
+  }
+  else if ( m_md.m_console.Scroll( -lines_ ) )
   {
-    return &m_md.m_highlightState;
+    m_scrollback += lines_;
+    m_base -= lines_ * cols;
   }
 
-  if ( right_ )
+  m_md.showOverlay();
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Copy()
+{
+  if ( m_empty )
+    (void)m_md.clearCb();
+  else if ( m_lineCount > 0 )
+    (void)copyLines();
+  else if ( m_range.block )
+    (void)m_md.copyBlockCb( m_range.from - m_base, m_range.to - m_base );
+  else
+    (void)m_md.copyCb( m_range.from - m_base, m_range.to - m_base );
+
+  m_md.m_persist.SaveClipboard( m_md.m_clipboard );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Settle()
+{
+  if ( m_lineCount == 0 )
+    return;
+
+  // Back to the bottom of the console. What is above it has been copied,
+  // only the part on screen stays highlighted.
+  if ( m_scrollback > 0 )
+    ScrollView( -m_scrollback );
+
+  m_lines.Clear();
+  m_lineCount = 0;
+  m_scrollLimit = c_maxScrollback;
+  Clamp();
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Hide()
+{
+  if ( !m_empty )
+    (void)paint( m_range, NULL, false );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Show()
+{
+  if ( !m_empty )
+    (void)paint( m_range, NULL, true );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Clamp()
+{
+  const bool block = m_range.block;
+
+  m_anchorBegin = clampPos( m_anchorBegin, block );
+  m_anchorEnd = clampPos( m_anchorEnd, block );
+  m_range.from = clampPos( m_range.from, block );
+  m_range.to = clampPos( m_range.to, block );
+  if ( m_pos >= 0 )
+    m_pos = clampPos( m_pos, block );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Shift(int rows_)
+{
+  // The text went up by rows_, and the highlight with it when the driver
+  // scrolls VRAM. Cells that lost it, e.g. after a full repaint, are found
+  // by draw() and are the only ones rendered again.
+  const bool block = m_range.block;
+  const int cols = m_md.m_geometry.GetCols();
+
+  if ( m_range.to < m_base + rows_ * cols )
+  {
+    // Scrolled off completely
+    m_empty = true;
+    m_range.from = m_base;
+    m_range.to = m_base - 1;
+  }
+  else
   {
-    (void)m_md.pasteCb();
+    m_range.from = shiftPos( m_range.from, rows_, block );
+    m_range.to = shiftPos( m_range.to, rows_, block );
   }
 
-  return this;
+  m_anchorBegin = shiftPos( m_anchorBegin, rows_, block );
+  m_anchorEnd = shiftPos( m_anchorEnd, rows_, block );
+
+  // The pointer did not move, the end of the range has to catch up with it
+  m_pos = -1;
+
+  Show();
 }
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::Restore(int from_, int to_, bool block_)
+{
+  // A selection kept by a previous instance, in screen positions. It is
+  // shown again but not copied, the clipboard came back with it.
+  Hide();
 
+  m_mode = block_ ? MODE_BLOCK : MODE_CHAR;
+  m_range.from = m_base + from_;
+  m_range.to = m_base + to_;
+  m_range.block = block_;
+  m_anchorBegin = m_range.from;
+  m_anchorEnd = m_range.from;
+  m_pos = -1;
+  m_empty = false;
 
+  Clamp();
+  Show();
+}
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::HighlightState
+bool PspMouseDaemon::Selection::GetSpan(int & from_, int & to_) const
+{
+  // Screen positions of the first and the last cell
+  if ( m_empty )
+    return false;
+
+  from_ = m_range.from - m_base;
+  to_ = m_range.to - m_base;
+  return true;
+}
 //-----------------------------------------------------------------------------
-PspMouseDaemon::HighlightState::HighlightState(PspMouseDaemon & md_)
-  : BaseState( md_ ),
-    m_begin( 0 ),
-    m_end( 0 ),
-    m_empty( true )
+int PspMouseDaemon::Selection::toPos(int col_, int row_)
 {
+  int pos;
+  m_md.consoleToLinear( col_, row_, pos );
+  return m_base + pos;
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState * 
-PspMouseDaemon::HighlightState::enterState()
+bool PspMouseDaemon::Selection::toCell(int pos_, int & col_, int & row_) const
 {
-  // Clear the previous highlight area if there is any
-  if ( !m_empty )
-    (void)clearHl( m_begin, m_end );
+  const int cols = m_md.m_geometry.GetCols();
 
-  // Record the beginning position
-  m_md.consoleToLinear( m_md.m_col, m_md.m_row, m_begin );
-  m_end = m_begin;
-  m_empty = true;
+  pos_ -= m_base;
+  if ( pos_ < 0 || pos_ >= m_md.m_consoleSize )
+    return false;
 
-  return this;
+  col_ = pos_ % cols;
+  row_ = pos_ / cols;
+  return true;
 }
 //-----------------------------------------------------------------------------
-void PspMouseDaemon::HighlightState::exitState()
+void PspMouseDaemon::Selection::extendTo(int pos_)
 {
+  if ( pos_ == m_pos )
+    return;
+
+  m_pos = pos_;
+
+  int col, row;
   if ( m_empty )
-    (void)m_md.clearCb();
+  {
+    m_empty = false;
+    // Clear the cursor, it was left on the anchor
+    if ( toCell( m_anchorBegin, col, row ) )
+      (void)m_md.clear( col, row, true, false );
+  }
+
+  Range range;
+  range.block = ( m_mode == MODE_BLOCK );
+
+  if ( range.block )
+  {
+    // Normalize the corners so that from is the top left one
+    const int cols = m_md.m_geometry.GetCols();
+    const int col0 = m_anchorBegin % cols;
+    const int row0 = m_anchorBegin / cols;
+    col = pos_ % cols;
+    row = pos_ / cols;
+    const int left   = ( col0 < col ) ? col0 : col;
+    const int right  = ( col0 < col ) ? col : col0;
+    const int top    = ( row0 < row ) ? row0 : row;
+    const int bottom = ( row0 < row ) ? row : row0;
+    range.from = top * cols + left;
+    range.to = bottom * cols + right;
+  }
   else
-    (void)m_md.copyCb( m_begin, m_end );
+  {
+    int begin, end;
+    unitAt( pos_, begin, end );
+    range.from = ( begin < m_anchorBegin ) ? begin : m_anchorBegin;
+    range.to = ( end > m_anchorEnd ) ? end : m_anchorEnd;
+  }
+
+  update( range );
 }
 //-----------------------------------------------------------------------------
-PspMouseDaemon::BaseState *
-PspMouseDaemon::HighlightState::processMouse
-(
-  bool left_,
-  bool mid_,
-  bool right_,
-  int x_,
-  int y_
-)
+bool PspMouseDaemon::Selection::stepBack()
 {
-  int col, row;
-  m_md.screenToConsole( x_, y_, col, row );
+  const int cols = m_md.m_geometry.GetCols();
+  const int rows = m_md.m_consoleSize / cols;
+
+  // Only a line that was never on screen is read, and proven first: the
+  // rows below it must show what the rows above them did before, or else
+  // the scrollback is used up and the view did not move
+  const bool stitch = ( m_scrollback + rows == m_lineCount );
 
-  if ( col != m_md.m_col || row != m_md.m_row )
+  if ( !m_md.m_console.Scroll( -1 ) )
+    return false;
+
+  if ( stitch )
   {
-    // Since the cursor has been moved, the content to-be-copied is not empty
-    if ( m_empty )
+    for ( int row = 1; row <= c_checkRows && row < rows; row++ )
     {
-      m_empty = false;
-      // Clear the cursor
-      (void)m_md.clear( m_md.m_col, m_md.m_row, true, false );
+      const char * line = lineAt( m_base / cols + row - 1 );
+      if ( line == NULL || !readRow( row, m_lineBuf ) ||
+           memcmp( m_lineBuf, line, cols ) != 0 )
+      {
+        m_scrollLimit = m_scrollback;
+        return false;
+      }
     }
 
-    m_md.m_col = col;
-    m_md.m_row = row;
+    char * line = m_lines.Extend( cols );
+    if ( line == NULL || !readRow( 0, line ) )
+    {
+      if ( line != NULL )
+        m_lines.Shrink( cols );
+      (void)m_md.m_console.Scroll( 1 );
+      m_scrollLimit = m_scrollback;
+      return false;
+    }
 
-    int newEnd;
-    m_md.consoleToLinear( col, row, newEnd );
+    m_lineCount++;
+    m_md.m_stats.Add( PspMdStats::LINES_STITCHED );
+  }
+
+  m_scrollback++;
+  m_base -= cols;
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Selection::readRow(int row_, char * buf_)
+{
+  const int cols = m_md.m_geometry.GetCols();
+  unsigned int bytesRead = 0;
 
-    if ( m_begin <= newEnd && newEnd < m_end )
-      (void)clearHl( newEnd + 1, m_end );
-    
-    else if ( newEnd < m_begin && m_begin < m_end )
-      (void)clearHl( m_begin + 1, m_end );
+  return m_md.m_console.Seek( (unsigned int)( row_ * cols ) ) &&
+         m_md.m_console.Read( buf_, cols, bytesRead ) &&
+         (int)bytesRead == cols;
+}
+//-----------------------------------------------------------------------------
+const char * PspMouseDaemon::Selection::lineAt(int line_) const
+{
+  // The bottom line of the console comes first
+  const int cols = m_md.m_geometry.GetCols();
+  const int rows = m_md.m_consoleSize / cols;
 
-    else if ( m_end < newEnd && newEnd <= m_begin )
-      (void)clearHl( m_end, newEnd - 1 );
-    
-    else if ( m_end < m_begin && m_begin < newEnd )
-      (void)clearHl( m_end, m_begin - 1 );
+  return m_lines.GetRecord( c_maxScrollback + rows - 1 - line_, cols );
+}
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Selection::copyLines()
+{
+  // Rows go out as lines without their trailing blanks, a few hundred rows
+  // of padding would paste as noise
+  PspMdClipboard & clipboard = m_md.m_clipboard;
+  const int cols = m_md.m_geometry.GetCols();
+  const int first = m_range.from / cols;
+  const int last = m_range.to / cols;
 
-    m_end = newEnd;
-    (void)drawHl( m_begin, m_end );
-    (void)m_md.sync();
-  }
+  clipboard.Clear();
 
-  if ( !left_ )
+  for ( int line = first; line <= last; line++ )
   {
-    // If left button is released, go back to cursor mode
-    return &m_md.m_cursorState;
+    const char * text = lineAt( line );
+    if ( text == NULL )
+      continue;
+
+    const int begin = ( m_range.block || line == first ) ?
+                      m_range.from % cols : 0;
+    const int end = ( m_range.block || line == last ) ?
+                    m_range.to % cols : cols - 1;
+
+    int length = end - begin + 1;
+    while ( length > 0 && text[ begin + length - 1 ] == ' ' )
+      length--;
+
+    if ( !clipboard.Append( text + begin, length ) ||
+         ( line < last && !clipboard.Append( "\n", 1 ) ) )
+    {
+      m_md.m_recorder.Record( EVT_ALLOC_FAIL, clipboard.GetSize() );
+      return false;
+    }
   }
 
-  return this;
+  m_md.m_recorder.Record( EVT_COPY, m_range.from, m_range.to,
+                          clipboard.GetSize() );
+  m_md.m_stats.Add( PspMdStats::COPY_BYTES, clipboard.GetSize() );
+  return true;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::HighlightState::drawHl(int begin_, int end_)
+int PspMouseDaemon::Selection::clampPos(int pos_, bool keepCol_) const
 {
-  int from = ( begin_ < end_ ) ? begin_ : end_;
-  int to   = ( begin_ < end_ ) ? end_ : begin_;
+  const int cols = m_md.m_geometry.GetCols();
+  const int size = m_md.m_consoleSize;
 
-  for ( int i = from; i <= to; i++ )
+  if ( pos_ < m_base )
+    return m_base + ( keepCol_ ? pos_ % cols : 0 );
+  if ( pos_ >= m_base + size )
+    return m_base + size - ( keepCol_ ? cols - pos_ % cols : 1 );
+  return pos_;
+}
+//-----------------------------------------------------------------------------
+int PspMouseDaemon::Selection::shiftPos
+(
+  int pos_,
+  int rows_,
+  bool keepCol_
+) const
+{
+  const int cols = m_md.m_geometry.GetCols();
+
+  // Positions above the screen stick to the top row
+  if ( pos_ - m_base >= rows_ * cols )
+    return pos_ - rows_ * cols;
+  return m_base + ( keepCol_ ? pos_ % cols : 0 );
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::unitAt(int pos_, int & begin_, int & end_)
+{
+  const int cols = m_md.m_geometry.GetCols();
+  const int lineStart = pos_ - pos_ % cols;
+
+  begin_ = pos_;
+  end_ = pos_;
+
+  if ( m_mode == MODE_LINE )
   {
-    int col, row;
-    m_md.linearToConsole( i, col, row );
+    begin_ = lineStart;
+    end_ = lineStart + cols - 1;
+    return;
+  }
 
-    if ( !m_md.draw( col, row, false, true ) )
-      return false;
+  int col, row;
+  if ( m_mode != MODE_WORD || cols > m_lineSize ||
+       !toCell( lineStart, col, row ) ||
+       !readRow( row, m_lineBuf ) )
+  {
+    return;
   }
 
-  return true;
+  // A word is a run of characters of the same class, punctuation marks
+  // stand alone
+  const char * line = m_lineBuf;
+  col = pos_ - lineStart;
+  const int cls = charClass( line[ col ] );
+  if ( cls == CLASS_PUNCT )
+    return;
+
+  int left = col;
+  int right = col;
+  while ( left > 0 && charClass( line[ left - 1 ] ) == cls )
+    left--;
+  while ( right < cols - 1 && charClass( line[ right + 1 ] ) == cls )
+    right++;
+
+  begin_ = lineStart + left;
+  end_ = lineStart + right;
+}
+//-----------------------------------------------------------------------------
+void PspMouseDaemon::Selection::update(const Range & range_)
+{
+  // Only the difference between the old and the new range is painted
+  (void)paint( m_range, &range_, false );
+  (void)paint( range_, &m_range, true );
+  m_range = range_;
 }
 //-----------------------------------------------------------------------------
-bool PspMouseDaemon::HighlightState::clearHl(int begin_, int end_)
+bool PspMouseDaemon::Selection::paint
+(
+  const Range & range_,
+  const Range * skip_,
+  bool draw_
+)
 {
-  int from = ( begin_ < end_ ) ? begin_ : end_;
-  int to   = ( begin_ < end_ ) ? end_ : begin_;
+  // Only the part on screen is painted. Lines count from the origin of
+  // the positions, rows from the top of the screen.
+  const int cols = m_md.m_geometry.GetCols();
+  const int top = m_base / cols;
+  const int bottom = top + m_md.m_consoleSize / cols - 1;
+  int col, row;
 
+  if ( range_.block )
+  {
+    const int left = range_.from % cols;
+    const int right = range_.to % cols;
+    const int first = ( range_.from / cols > top ) ? range_.from / cols : top;
+    const int last = ( range_.to / cols < bottom ) ? range_.to / cols : bottom;
+
+    for ( int line = first; line <= last; line++ )
+    {
+      row = line - top;
+      for ( col = left; col <= right; col++ )
+      {
+        if ( skip_ != NULL && contains( *skip_, col, line ) )
+          continue;
+
+        if ( draw_ ? !m_md.draw( col, row, false, true )
+                   : !m_md.clear( col, row, false, true ) )
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  const int from = ( range_.from > m_base ) ? range_.from : m_base;
+  const int to = ( range_.to < m_base + m_md.m_consoleSize ) ?
+                 range_.to : m_base + m_md.m_consoleSize - 1;
+  if ( !toCell( from, col, row ) )
+    return true;
+
+  // Walk the cells in order instead of converting every position
   for ( int i = from; i <= to; i++ )
   {
-    int col, row;
-    m_md.linearToConsole( i, col, row );
+    if ( skip_ == NULL || !contains( *skip_, col, row + top ) )
+    {
+      if ( draw_ ? !m_md.draw( col, row, false, true )
+                 : !m_md.clear( col, row, false, true ) )
+      {
+        return false;
+      }
+    }
 
-    if ( !m_md.clear( col, row, false, true ) )
-      return false;
+    if ( ++col == cols )
+    {
+      col = 0;
+      row++;
+    }
   }
 
   return true;
 }
+//-----------------------------------------------------------------------------
+bool PspMouseDaemon::Selection::contains
+(
+  const Range & range_,
+  int col_,
+  int line_
+) const
+{
+  const int cols = m_md.m_geometry.GetCols();
 
+  if ( range_.block )
+  {
+    return col_ >= range_.from % cols && col_ <= range_.to % cols &&
+           line_ >= range_.from / cols && line_ <= range_.to / cols;
+  }
+
+  const int pos = line_ * cols + col_;
+  return pos >= range_.from && pos <= range_.to;
+}
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -3,99 +3,140 @@
 #endif
 
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::BaseState
+// States, inputs and actions of the state machine
+//
+// The machine is a table indexed by state and input. An entry gives the
+// next state and the action run before the transition; entering and
+// leaving a state is handled once in changeState(). Inputs are made from
+// the decoded mouse events, so a run of motion-only packets arrives as a
+// single INPUT_MOTION.
 //-----------------------------------------------------------------------------
-class BaseState
+enum State
 {
-public:
-  BaseState(PspMouseDaemon & md_);
-  virtual ~BaseState() { }
-
-  virtual BaseState * enterState();
-  virtual void        exitState();
-  virtual BaseState * processMouse(bool left_, bool mid_, bool right_, int x_, int y_);
-  virtual bool        isFailed()  { return false; }
-
-protected:
-  PspMouseDaemon & m_md;
-
-private:
-  // Not implemented
-  BaseState();
-  BaseState(const BaseState &);
-  BaseState & operator = (const BaseState &);
+  STATE_FAILED = 0,
+  STATE_CURSOR,
+  STATE_SELECT,             // Left drag, character selection
+  STATE_SELECT_WORD,        // Double click and drag
+  STATE_SELECT_LINE,        // Triple click and drag
+  STATE_SELECT_BLOCK,       // Right button pressed during a left drag
+  STATE_SCROLL,             // Middle drag scrolls the console
+  STATE_MAX
 };
 
-
-//-----------------------------------------------------------------------------
-// class PspMouseDaemon::FailedState
-//-----------------------------------------------------------------------------
-class FailedState : public BaseState
+enum Input
 {
-public:
-  FailedState(PspMouseDaemon & md_);
-
-  virtual BaseState * enterState();
-  virtual bool        isFailed()  { return true; }
-
-protected:
-private:
-  // Not implemented
-  FailedState();
-  FailedState(const FailedState &);
-  FailedState & operator = (const FailedState &);
+  INPUT_MOTION = 0,
+  INPUT_LEFT_DOWN,
+  INPUT_LEFT_DOUBLE,
+  INPUT_LEFT_TRIPLE,
+  INPUT_LEFT_UP,
+  INPUT_MID_DOWN,
+  INPUT_MID_UP,
+  INPUT_RIGHT_DOWN,
+  INPUT_RIGHT_UP,
+  INPUT_MAX
 };
 
-
-//-----------------------------------------------------------------------------
-// class PspMouseDaemon::CursorState
-//-----------------------------------------------------------------------------
-class CursorState : public BaseState
+enum Action
 {
-public:
-  CursorState(PspMouseDaemon & md_);
-
-  virtual BaseState * enterState();
-  virtual BaseState * processMouse(bool left_, bool mid_, bool right_, int x_, int y_);
-
-protected:
+  ACTION_NONE = 0,
+  ACTION_MOVE,              // Move the cursor
+  ACTION_EXTEND,            // Extend the selection to the pointer
+  ACTION_SCROLL,            // Scroll by the vertical motion
+  ACTION_PASTE
+};
 
-private:
-  // Not implemented
-  CursorState();
-  CursorState(const CursorState &);
-  CursorState & operator = (const CursorState &);
+struct Transition
+{
+  unsigned char next;
+  unsigned char action;
 };
 
 
 //-----------------------------------------------------------------------------
-// class PspMouseDaemon::HighlightState
+// class PspMouseDaemon::Selection
+//
+// Positions count cells from a fixed origin above the scrollback, so a
+// selection keeps its text while the view moves. Dragging against the top
+// or bottom edge scrolls the view a line at a time; the lines coming into
+// view are kept as they appear, and the copy is made from them rather than
+// from the screen.
 //-----------------------------------------------------------------------------
-class HighlightState : public BaseState
+class Selection
 {
 public:
-  HighlightState(PspMouseDaemon & md_);
-
-  virtual BaseState * enterState();
-  virtual void        exitState();
-  virtual BaseState * processMouse(bool left_, bool mid_, bool right_, int x_, int y_);
+  enum Mode
+  {
+    MODE_CHAR = 0,
+    MODE_WORD,
+    MODE_LINE,
+    MODE_BLOCK
+  };
+
+  Selection(PspMouseDaemon & md_);
+  ~Selection();
+
+  bool Resize(int cols_);
+  void Begin(Mode mode_, int col_, int row_);
+  void Extend(int col_, int row_);
+  void SetMode(Mode mode_);
+  void ScrollView(int lines_);
+  void Copy();
+  void Settle();
+  void Hide();
+  void Show();
+  void Clamp();
+  void Shift(int rows_);
+  void Restore(int from_, int to_, bool block_);
+  bool IsEmpty() const      { return m_empty; }
+  bool IsScrolled() const   { return m_lineCount > 0; }
+  bool IsBlock() const      { return m_range.block; }
+  bool GetSpan(int & from_, int & to_) const;
 
 protected:
-  bool drawHl(int begin_, int end_);
-  bool clearHl(int begin_, int end_);
+  struct Range
+  {
+    int from;               // Cell positions, corners in block mode
+    int to;
+    bool block;
+  };
+
+  int toPos(int col_, int row_);
+  bool toCell(int pos_, int & col_, int & row_) const;
+  void extendTo(int pos_);
+  bool stepBack();
+  bool readRow(int row_, char * buf_);
+  const char * lineAt(int line_) const;
+  bool copyLines();
+  int clampPos(int pos_, bool keepCol_) const;
+  void unitAt(int pos_, int & begin_, int & end_);
+  int shiftPos(int pos_, int rows_, bool keepCol_) const;
+  void update(const Range & range_);
+  bool paint(const Range & range_, const Range * skip_, bool draw_);
+  bool contains(const Range & range_, int col_, int line_) const;
 
-  int m_begin;
-  int m_end;
+  PspMouseDaemon & m_md;
+  Mode m_mode;
+  int m_anchorBegin;        // Unit under the press, a word or a line may
+  int m_anchorEnd;          // span more than one cell
+  int m_pos;                // Pointer position the range was built for
+  Range m_range;            // Cells currently highlighted
   bool m_empty;
+  char * m_lineBuf;         // One console row, for word boundaries
+  int m_lineSize;
+  int m_base;               // Position of the top left cell on screen
+  int m_scrollback;         // Lines the view is scrolled back
+  int m_scrollLimit;        // Lines the console has been found to keep
+  PspMdClipboard m_lines;   // Lines seen during the drag, newest first
+  int m_lineCount;
 
 private:
   // Not implemented
-  HighlightState();
-  HighlightState(const HighlightState &);
-  HighlightState & operator = (const HighlightState &);
+  Selection();
+  Selection(const Selection &);
+  Selection & operator = (const Selection &);
 };
 
-
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -0,0 +1,202 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+static const char   c_tempSuffix[]        = ".tmp";
+static const time_t c_statsInterval       = 1;    // 1 second
+static const int    c_statsBufSize        = 1024;
+
+static const char * const c_counterNames[ PspMdStats::COUNTER_MAX ] =
+{
+  "packets_read",
+  "packets_coalesced",
+  "state_transitions",
+  "cells_drawn",
+  "cells_cleared",
+  "pixels_xored",
+  "fsync_calls",
+  "fsync_usec",
+  "copy_bytes",
+  "paste_bytes",
+  "device_errors",
+  "startup_usec",
+  "page_flips",
+  "rows_copied",
+  "page_faults_per_sec",
+  "ctx_switches_per_sec",
+  "pixels_blended",
+  "lines_stitched",
+  "search_runs",
+  "events_published",
+  "events_reported",
+  "control_batches",
+  "control_events",
+  "wakeups",
+  "wakeups_per_sec",
+  "heap_allocs",
+  "arena_bytes"
+};
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdStats
+//-----------------------------------------------------------------------------
+PspMdStats::PspMdStats()
+  : m_fileName( NULL ),
+    m_lastExport( 0 ),
+    m_dirty( false ),
+    m_usageTime( 0 ),
+    m_usageFaults( 0 ),
+    m_usageSwitches( 0 ),
+    m_usageWakeups( 0 )
+{
+  memset( m_counters, 0, sizeof( m_counters ) );
+  m_tempName[ 0 ] = '\0';
+}
+//-----------------------------------------------------------------------------
+PspMdStats::~PspMdStats()
+{
+  if ( m_fileName != NULL )
+  {
+    (void)Export( true );
+    m_fileName = NULL;
+  }
+}
+//-----------------------------------------------------------------------------
+bool PspMdStats::Initialize(const char * fileName_)
+{
+  if ( m_fileName != NULL )
+  {
+    DBG(( DBG_PREFIX "PspMdStats has been initialized\n" ));
+    return true;
+  }
+
+  if ( strlen( fileName_ ) + sizeof( c_tempSuffix ) > sizeof( m_tempName ) )
+  {
+    DBG(( DBG_PREFIX "Stats file name too long: %s\n", fileName_ ));
+    return false;
+  }
+
+  strcpy( m_tempName, fileName_ );
+  strcat( m_tempName, c_tempSuffix );
+  m_fileName = fileName_;
+
+  sampleUsage( time( NULL ) );
+  if ( !Export( true ) )
+  {
+    m_fileName = NULL;
+    return false;
+  }
+
+  return true;
+}
+//-----------------------------------------------------------------------------
+bool PspMdStats::Export(bool force_)
+{
+  if ( m_fileName == NULL )
+    return false;
+
+  time_t now = time( NULL );
+  if ( !force_ )
+  {
+    if ( !m_dirty || now - m_lastExport < c_statsInterval )
+      return true;
+  }
+
+  sampleUsage( now );
+
+  char buf[ c_statsBufSize ];
+  int len = format( buf, sizeof( buf ) );
+
+  // Written aside and renamed over the file, so readers always open one
+  // complete snapshot
+  const int fd = open( m_tempName, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if ( fd < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to create stats file %s, err=%d\n",
+          m_tempName, errno ));
+    return false;
+  }
+
+  const bool written = ( write( fd, buf, len ) == len );
+  if ( close( fd ) < 0 || !written ||
+       rename( m_tempName, m_fileName ) < 0 )
+  {
+    DBG(( DBG_PREFIX "Failed to export stats, err=%d\n", errno ));
+    (void)unlink( m_tempName );
+    return false;
+  }
+
+  m_lastExport = now;
+  m_dirty = false;
+  return true;
+}
+//-----------------------------------------------------------------------------
+void PspMdStats::ResetRates()
+{
+  // The daemon stops waking up, the rates of the last busy interval would
+  // stay in the file until it does. The next sample starts them over.
+  Set( PAGE_FAULTS_PER_SEC, 0 );
+  Set( CTX_SWITCHES_PER_SEC, 0 );
+  Set( WAKEUPS_PER_SEC, 0 );
+  m_usageTime = 0;
+}
+//-----------------------------------------------------------------------------
+void PspMdStats::sampleUsage(time_t now_)
+{
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) < 0 )
+    return;
+
+  long faults = usage.ru_minflt + usage.ru_majflt;
+  long switches = usage.ru_nvcsw + usage.ru_nivcsw;
+
+  if ( m_usageTime != 0 && now_ > m_usageTime )
+  {
+    long elapsed = (long)( now_ - m_usageTime );
+    m_counters[ PAGE_FAULTS_PER_SEC ] =
+        (unsigned int)( ( faults - m_usageFaults ) / elapsed );
+    m_counters[ CTX_SWITCHES_PER_SEC ] =
+        (unsigned int)( ( switches - m_usageSwitches ) / elapsed );
+    m_counters[ WAKEUPS_PER_SEC ] =
+        ( m_counters[ WAKEUPS ] - m_usageWakeups ) / (unsigned int)elapsed;
+  }
+
+  m_usageTime = now_;
+  m_usageFaults = faults;
+  m_usageSwitches = switches;
+  m_usageWakeups = m_counters[ WAKEUPS ];
+}
+//-----------------------------------------------------------------------------
+int PspMdStats::format(char * buf_, int size_)
+{
+  int len = 0;
+
+  for ( int i = 0; i < COUNTER_MAX && len < size_; i++ )
+  {
+    len += snprintf( buf_ + len, size_ - len, "%s=%u\n",
+                     c_counterNames[ i ], m_counters[ i ] );
+  }
+
+  return ( len < size_ ) ? len : size_ - 1;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
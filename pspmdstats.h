@@ -0,0 +1,111 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDSTATS_H
+#define PSPMDSTATS_H
+
+#include <time.h>
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdStats
+//
+// Runtime counters of the daemon. Counters are plain integers bumped on the
+// hot paths; the whole set is exported as "key=value" lines to a stats file
+// at most once per export interval, so the cost of a bump stays one add.
+//-----------------------------------------------------------------------------
+class PspMdStats
+{
+public:
+  enum
+  {
+    NAME_SIZE     = 64          // Longest stats file name, with the suffix
+  };
+
+  enum Counter
+  {
+    PACKETS_READ = 0,
+    PACKETS_COALESCED,
+    STATE_TRANSITIONS,
+    CELLS_DRAWN,
+    CELLS_CLEARED,
+    PIXELS_XORED,
+    FSYNC_CALLS,
+    FSYNC_USEC,
+    COPY_BYTES,
+    PASTE_BYTES,
+    DEVICE_ERRORS,
+    STARTUP_USEC,
+    PAGE_FLIPS,
+    ROWS_COPIED,
+    PAGE_FAULTS_PER_SEC,
+    CTX_SWITCHES_PER_SEC,
+    PIXELS_BLENDED,
+    LINES_STITCHED,
+    SEARCH_RUNS,
+    EVENTS_PUBLISHED,
+    EVENTS_REPORTED,
+    CONTROL_BATCHES,
+    CONTROL_EVENTS,
+    WAKEUPS,
+    WAKEUPS_PER_SEC,
+    HEAP_ALLOCS,
+    ARENA_BYTES,
+    COUNTER_MAX
+  };
+
+  PspMdStats();
+  ~PspMdStats();
+
+  bool Initialize(const char * fileName_);
+  bool Export(bool force_ = false);
+  void ResetRates();
+
+  void Add(Counter counter_, unsigned int value_ = 1)
+  {
+    m_counters[ counter_ ] += value_;
+    m_dirty = true;
+  }
+
+  void Set(Counter counter_, unsigned int value_)
+  {
+    if ( m_counters[ counter_ ] != value_ )
+    {
+      m_counters[ counter_ ] = value_;
+      m_dirty = true;
+    }
+  }
+
+  unsigned int Get(Counter counter_) const { return m_counters[ counter_ ]; }
+
+protected:
+  void sampleUsage(time_t now_);
+  int format(char * buf_, int size_);
+
+  unsigned int m_counters[ COUNTER_MAX ];
+  const char * m_fileName;
+  char m_tempName[ NAME_SIZE ];   // Written, then renamed over m_fileName
+  time_t m_lastExport;
+  bool m_dirty;
+
+  // Previous getrusage() sample for the per-second rates
+  time_t m_usageTime;
+  long m_usageFaults;
+  long m_usageSwitches;
+  unsigned int m_usageWakeups;
+
+private:
+  // Not implemented
+  PspMdStats(const PspMdStats &);
+  PspMdStats & operator = (const PspMdStats &);
+};
+
+
+#endif  // PSPMDSTATS_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
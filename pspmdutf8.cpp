@@ -0,0 +1,49 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#include "pspmd.h"
+#include <stdio.h>
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdUtf8
+//-----------------------------------------------------------------------------
+const unsigned char PspMdUtf8::s_length[ 33 ] =
+{
+  1, 1, 1, 1, 1, 1, 1, 1,       // Up to 7 bits
+  2, 2, 2, 2,                   // Up to 11 bits
+  3, 3, 3, 3, 3,                // Up to 16 bits
+  4, 4, 4, 4, 4,                // Up to 21 bits
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4
+};
+//-----------------------------------------------------------------------------
+const unsigned char PspMdUtf8::s_lead[ MAX_BYTES + 1 ] =
+{
+  0x00, 0x00, 0xc0, 0xe0, 0xf0
+};
+//-----------------------------------------------------------------------------
+int PspMdUtf8::EncodeRow(const unsigned int * cells_, int count_, char * out_)
+{
+  // The end of the last cell that is not blank moves along with the
+  // encoding, so the trailing blanks are dropped in the same pass
+  char * p = out_;
+  char * end = out_;
+
+  for ( int i = 0; i < count_; i++ )
+  {
+    p += Encode( cells_[ i ], p );
+    if ( cells_[ i ] != ' ' )
+      end = p;
+  }
+
+  return end - out_;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
@@ -0,0 +1,64 @@
+/*-----------------------------------------------------------------------------
+ * Text console Mouse Daemon for uClinux on PSP
+ * Created by Jackson Mo, Jan 29, 2008
+ *---------------------------------------------------------------------------*/
+#ifndef PSPMDUTF8_H
+#define PSPMDUTF8_H
+
+
+//-----------------------------------------------------------------------------
+// Class: PspMdUtf8
+//
+// UTF-8 encoder for the code points read from /dev/vcsu. ASCII takes one
+// compare; any other code point gets its length from a table indexed by
+// its bit count, which comes from a single count leading zeros, and the
+// bytes are written by one loop without further tests. Surrogates and
+// values beyond Unicode are written as U+FFFD.
+//-----------------------------------------------------------------------------
+class PspMdUtf8
+{
+public:
+  enum
+  {
+    MAX_BYTES     = 4,          // Per code point
+    MAX_CODE      = 0x10ffff,
+    REPLACEMENT   = 0xfffd
+  };
+
+  static int Encode(unsigned int code_, char * out_)
+  {
+    if ( code_ < 0x80 )
+    {
+      *out_ = (char)code_;
+      return 1;
+    }
+
+    if ( code_ > MAX_CODE || ( code_ & 0xfffff800 ) == 0xd800 )
+      code_ = REPLACEMENT;
+
+    const int length = s_length[ 32 - __builtin_clz( code_ ) ];
+    for ( int i = length - 1; i > 0; i-- )
+    {
+      out_[ i ] = (char)( 0x80 | ( code_ & 0x3f ) );
+      code_ >>= 6;
+    }
+
+    out_[ 0 ] = (char)( s_lead[ length ] | code_ );
+    return length;
+  }
+
+  static int EncodeRow(const unsigned int * cells_, int count_, char * out_);
+
+protected:
+  static const unsigned char s_length[ 33 ];
+  static const unsigned char s_lead[ MAX_BYTES + 1 ];
+};
+
+
+#endif  // PSPMDUTF8_H
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------